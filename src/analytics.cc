@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "analytics.h"
+
+namespace analytics {
+
+namespace {
+
+    constexpr std::size_t spenders_capacity = 64;
+    constexpr std::size_t spenders_reported = 10;
+
+    // `std::hash` of a string is not required to spread its bits well, while
+    // HyperLogLog relies on that, hence the splitmix64 finalizer on top
+    auto hash_name(std::string_view name) -> std::uint64_t
+    {
+        std::uint64_t x = std::hash<std::string_view> {}(name);
+
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+        return x ^ (x >> 31);
+    }
+
+    auto write_minutes(FILE *f, std::size_t minutes) -> void
+    {
+        std::size_t h, m;
+        timeutil::time_point_hm(minutes, h, m);
+
+        fprintf(f, "%02zu:%02zu", h, m);
+    }
+
+} // namespace
+
+auto HyperLogLog::add(std::uint64_t hash) -> void
+{
+    const auto index = hash >> (64 - precision);
+    // the sentinel bit bounds the rank for hashes with all the rest bits unset
+    const auto rest = (hash << precision) | (1ULL << (precision - 1));
+    const auto rank = static_cast<std::uint8_t>(std::countl_zero(rest) + 1);
+
+    registers[index] = std::max(registers[index], rank);
+}
+
+auto HyperLogLog::estimate() const -> double
+{
+    constexpr double m     = register_count;
+    constexpr double alpha = 0.7213 / (1.0 + 1.079 / m);
+
+    double      sum   = 0.0;
+    std::size_t zeros = 0;
+    for (const auto r : registers) {
+        sum += std::ldexp(1.0, -r);
+        zeros += r == 0;
+    }
+
+    const double estimate = alpha * m * m / sum;
+
+    // small cardinalities are a lot more precise with linear counting
+    if (estimate <= 2.5 * m && zeros != 0)
+        return m * std::log(m / static_cast<double>(zeros));
+
+    return estimate;
+}
+
+MinuteHistogram::MinuteHistogram()
+    : buckets(bucket_count)
+{
+}
+
+auto MinuteHistogram::add(std::size_t minutes) -> void
+{
+    ++buckets[std::min(minutes, bucket_count - 1)];
+    ++total;
+}
+
+auto MinuteHistogram::quantile(double q) const -> std::size_t
+{
+    const auto rank = static_cast<std::size_t>(
+        std::ceil(q * static_cast<double>(total)));
+
+    std::size_t seen = 0;
+    for (std::size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank && seen != 0)
+            return i;
+    }
+
+    return 0;
+}
+
+SpaceSaving::SpaceSaving(std::size_t capacity)
+    : capacity(capacity)
+{
+    entries.reserve(capacity);
+    index.reserve(capacity);
+}
+
+auto SpaceSaving::add(std::string_view key, std::size_t weight) -> void
+{
+    if (const auto it = index.find(key); it != index.end()) {
+        entries[it->second].weight += weight;
+        return;
+    }
+
+    if (entries.size() < capacity) {
+        index.emplace(key, entries.size());
+        entries.push_back({ std::string { key }, weight, 0 });
+        return;
+    }
+
+    // the lightest key gives its place away, the newcomer inherits its weight
+    // as the possible overestimation
+    const auto min = std::min_element(entries.begin(), entries.end(),
+        [](const Entry &a, const Entry &b) { return a.weight < b.weight; });
+
+    index.erase(min->key);
+    index.emplace(key, min - entries.begin());
+
+    min->error = min->weight;
+    min->weight += weight;
+    min->key = key;
+}
+
+auto SpaceSaving::top(std::size_t n) const -> std::vector<Entry>
+{
+    std::vector<Entry> result { entries };
+
+    std::sort(result.begin(), result.end(),
+        [](const Entry &a, const Entry &b) { return a.weight > b.weight; });
+
+    if (result.size() > n)
+        result.resize(n);
+
+    return result;
+}
+
+Analytics::Analytics()
+    : spenders(spenders_capacity)
+{
+}
+
+auto Analytics::record_session(std::string_view client,
+    timeutil::TimePoint came_in, timeutil::TimePoint left) -> void
+{
+    left = std::max(left, came_in);
+
+    session_lengths.add(left - came_in);
+
+    const auto hash = hash_name(client);
+    for (std::size_t h = came_in / 60; h <= left / 60 && h < 24; ++h)
+        distinct_per_hour[h].add(hash);
+}
+
+auto Analytics::record_wait(timeutil::TimePoint since, timeutil::TimePoint sat)
+    -> void
+{
+    wait_times.add(sat > since ? sat - since : 0);
+}
+
+auto Analytics::record_queue_request(bool abandoned) -> void
+{
+    ++queue_requests;
+    queue_abandoned += abandoned;
+}
+
+auto Analytics::record_queue_timeout() -> void { ++queue_abandoned; }
+
+auto Analytics::record_charge(std::string_view client, std::size_t amount)
+    -> void
+{
+    revenue += amount;
+    spenders.add(client, amount);
+}
+
+auto Analytics::write_report(FILE *f) const -> int
+{
+    fprintf(f, "sessions %zu revenue %zu\n", session_lengths.count(), revenue);
+
+    fprintf(f, "distinct clients per hour:\n");
+    for (std::size_t h = 0; h < 24; ++h) {
+        const auto estimate = std::llround(distinct_per_hour[h].estimate());
+        if (estimate != 0)
+            fprintf(f, "%02zu:00 %lld\n", h, estimate);
+    }
+
+    const auto write_distribution = [f](const char *name,
+                                        const MinuteHistogram &hist) {
+        fprintf(f, "%s: count %zu", name, hist.count());
+
+        for (const auto &[label, q] : { std::pair { "p50", 0.5 },
+                 std::pair { "p90", 0.9 }, std::pair { "p99", 0.99 },
+                 std::pair { "max", 1.0 } }) {
+            fprintf(f, " %s ", label);
+            write_minutes(f, hist.quantile(q));
+        }
+
+        putc('\n', f);
+    };
+
+    write_distribution("session length", session_lengths);
+    write_distribution("wait time", wait_times);
+
+    fprintf(f, "queue abandonment: %zu of %zu (%.1f%%)\n", queue_abandoned,
+        queue_requests,
+        queue_requests == 0
+            ? 0.0
+            : 100.0 * static_cast<double>(queue_abandoned)
+                / static_cast<double>(queue_requests));
+
+    fprintf(f, "top spenders:\n");
+    for (const auto &e : spenders.top(spenders_reported)) {
+        fprintf(f, "%s %zu", e.key.c_str(), e.weight);
+        if (e.error != 0)
+            fprintf(f, " (+-%zu)", e.error);
+        putc('\n', f);
+    }
+
+    return ferror(f);
+}
+
+} // namespace analytics
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "timeutil.h"
+
+// Per-client and per-hour statistics collected during the simulation itself.
+// Everything here takes a fixed amount of memory, no matter how many clients
+// or events the log has.
+namespace analytics {
+
+// Approximate count of distinct values, ~3% standard error.
+class HyperLogLog {
+    static constexpr unsigned    precision      = 10;
+    static constexpr std::size_t register_count = 1 << precision;
+
+    std::array<std::uint8_t, register_count> registers {};
+
+public:
+    auto add(std::uint64_t hash) -> void;
+
+    [[nodiscard]] auto estimate() const -> double;
+};
+
+// Exact distribution of durations with a minute resolution. Time points never
+// go past one day, so the buckets are bounded and it is cheaper than any
+// quantile sketch.
+class MinuteHistogram {
+    static constexpr std::size_t bucket_count = 24 * 60 + 1;
+
+    std::vector<std::size_t> buckets;
+    std::size_t              total { 0 };
+
+public:
+    MinuteHistogram();
+
+    auto add(std::size_t minutes) -> void;
+
+    [[nodiscard]] auto count() const -> std::size_t { return total; }
+
+    // smallest duration, which at least `q` of the values do not exceed
+    [[nodiscard]] auto quantile(double q) const -> std::size_t;
+};
+
+// Space-Saving heavy hitters: tracks at most `capacity` keys, every key with
+// the weight above total / `capacity` is guaranteed to be among them.
+class SpaceSaving {
+public:
+    struct Entry {
+        std::string key;
+        std::size_t weight;
+        std::size_t error; // the weight may be overestimated by this much
+    };
+
+private:
+    // needed for the lookups by `std::string_view` without a temporary string
+    struct KeyHash {
+        using is_transparent = void;
+
+        auto operator()(std::string_view s) const -> std::size_t
+        {
+            return std::hash<std::string_view> {}(s);
+        }
+    };
+
+    std::size_t        capacity;
+    std::vector<Entry> entries;
+    // key -> entry
+    std::unordered_map<std::string, std::size_t, KeyHash, std::equal_to<>>
+        index;
+
+public:
+    explicit SpaceSaving(std::size_t capacity);
+
+    auto add(std::string_view key, std::size_t weight) -> void;
+
+    // the heaviest `n` entries, heaviest first
+    [[nodiscard]] auto top(std::size_t n) const -> std::vector<Entry>;
+};
+
+class Analytics {
+    HyperLogLog     distinct_per_hour[24];
+    MinuteHistogram session_lengths;
+    MinuteHistogram wait_times;
+    SpaceSaving     spenders;
+
+    std::size_t queue_requests { 0 };
+    std::size_t queue_abandoned { 0 };
+    std::size_t revenue { 0 };
+
+public:
+    Analytics();
+
+    // the client has left the club, being inside during [came_in, left]
+    auto record_session(std::string_view client, timeutil::TimePoint came_in,
+        timeutil::TimePoint left) -> void;
+
+    // the client has waited in the queue during [since, sat]
+    auto record_wait(timeutil::TimePoint since, timeutil::TimePoint sat)
+        -> void;
+
+    // the client has asked to wait, `abandoned` if sent away as the queue was
+    // full
+    auto record_queue_request(bool abandoned) -> void;
+
+    // the client has given up waiting in the queue
+    auto record_queue_timeout() -> void;
+
+    auto record_charge(std::string_view client, std::size_t amount) -> void;
+
+    auto write_report(FILE *f) const -> int;
+};
+
+} // namespace analytics
@@ -0,0 +1,88 @@
+#include <set>
+
+#include "club.h"
+#include "memstats.h"
+
+namespace club {
+
+Session::Session(
+    const event_system::Config &cfg, FILE *out, const Options &options)
+    : out(out)
+    , cfg(cfg)
+    , used_tables_only(options.used_tables_only)
+    , system(cfg.tables_count, cfg.work_hours, cfg.hour_cost)
+{
+    if (options.with_analytics)
+        system.set_analytics(&collector.emplace());
+
+    system.set_limits(options.limits);
+
+    std::size_t h, m;
+    timeutil::time_point_hm(cfg.work_hours.begin, h, m);
+
+    fprintf(out, "%02zu:%02zu\n", h, m);
+}
+
+auto Session::fire_timers(timeutil::TimePoint time) -> void
+{
+    fired.clear();
+    system.fire_timers(time, fired);
+
+    if (fired.empty())
+        return;
+
+    line.clear();
+    for (const auto &e : fired)
+        event_system::format_event(line, e);
+
+    fwrite(line.data(), 1, line.size(), out);
+}
+
+auto Session::handle(event_system::Event &event) -> void
+{
+    fire_timers(event.time);
+
+    line.clear();
+    event_system::format_event(line, event);
+
+    std::optional<event_system::Event> out_e;
+
+    const auto buckets = system.client_bucket_count();
+    system.handle_event(event, out_e);
+    if (system.client_bucket_count() != buckets)
+        memstats::record_rehash();
+
+    if (out_e.has_value())
+        event_system::format_event(line, out_e.value());
+
+    fwrite(line.data(), 1, line.size(), out);
+}
+
+auto Session::close() -> void
+{
+    fire_timers(cfg.work_hours.end);
+
+    std::set<event_system::Event> last_events;
+    {
+        memstats::Scope scope { memstats::phase_close_out };
+        system.kick_everyone_out(last_events);
+    }
+
+    memstats::Scope scope { memstats::phase_report };
+
+    std::size_t h, m;
+    timeutil::time_point_hm(cfg.work_hours.end, h, m);
+
+    for (const auto &e : last_events)
+        fprintf(out, "%02zu:%02zu %u %.*s\n", h, m, e.type,
+            (int)e.client_name.length(), e.client_name.data());
+
+    fprintf(out, "%02zu:%02zu\n", h, m);
+
+    system.write_tables_stats(out, used_tables_only);
+
+    if (collector.has_value())
+        collector->write_report(out);
+}
+
+} // namespace club
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "analytics.h"
+#include "event_system.h"
+
+namespace club {
+
+struct Options {
+    // the analytics report follows the tables' statistics
+    bool                 with_analytics { false };
+    // only the tables, which were used, are in the tables' statistics
+    bool                 used_tables_only { false };
+    event_system::Limits limits {};
+};
+
+// One club's working day fed event by event and written to `out` in the
+// program's output format: the opening time, every incoming event followed by
+// the generated one, and, once closed, the last events and tables' statistics.
+// Events generated by the timers go before the incoming event they are due
+// by.
+class Session {
+    FILE                               *out;
+    event_system::Config                cfg;
+    bool                                used_tables_only;
+    event_system::EventSystem           system;
+    std::optional<analytics::Analytics> collector;
+    std::string                         line;  // reused output buffer
+    std::vector<event_system::Event>    fired; // reused for the timers' events
+
+    // writes the events generated by the timers due at or before `time`
+    auto fire_timers(timeutil::TimePoint time) -> void;
+
+public:
+    // writes the opening time
+    Session(const event_system::Config &cfg, FILE *out, const Options &options);
+
+    // `system` refers to `collector`
+    Session(const Session &)                     = delete;
+    auto operator=(const Session &) -> Session & = delete;
+
+    auto handle(event_system::Event &event) -> void;
+
+    // kicks everyone out and writes the rest of the output
+    auto close() -> void;
+};
+
+} // namespace club
@@ -1,10 +1,27 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
 
 #include "event_system.h"
 
 namespace event_system {
 
+namespace {
+
+    // `clients` is reserved for twice the tables, but not for a venue with
+    // millions of mostly unused table ids
+    constexpr std::size_t max_reserved_tables = 1 << 16;
+
+} // namespace
+
+const char *computer_club_error_str[] = {
+    "YouShallNotPass",
+    "NotOpenYet",
+    "PlaceIsBusy",
+    "ClientUnknown",
+    "ICanWaitNoLonger!",
+};
+
 Table::Table(std::size_t id)
     : id(id)
 {
@@ -21,20 +38,26 @@ auto Table::sit(timeutil::TimePoint time) -> void
     is_occupied = true;
 }
 
-auto Table::leave(timeutil::TimePoint time, std::size_t hour_cost) -> void
+auto Table::leave(timeutil::TimePoint time, std::size_t hour_cost)
+    -> std::size_t
 {
     if (!is_occupied) {
-        return; // no-op, as it was not sitted on at the time
+        return 0; // no-op, as it was not sitted on at the time
     }
 
     auto delta = time - last_sit.value();
     last_sit   = std::nullopt;
 
-    total_mins += delta;
-    revenue += static_cast<size_t>(std::ceil(static_cast<double>(delta) / 60.0))
+    const auto cost
+        = static_cast<size_t>(std::ceil(static_cast<double>(delta) / 60.0))
         * hour_cost;
 
+    total_mins += delta;
+    revenue += cost;
+
     is_occupied = false;
+
+    return cost;
 }
 
 auto Table::write_stats_to_file(FILE *f) const -> int
@@ -49,6 +72,36 @@ auto Table::write_stats_to_file(FILE *f) const -> int
 
 [[nodiscard]] constexpr auto Table::get_id() const -> std::size_t { return id; }
 
+TableStore::TableStore(std::size_t count)
+    : count(count)
+    , pages((count + page_size - 1) / page_size)
+{
+}
+
+auto TableStore::operator[](std::size_t id) -> Table &
+{
+    auto &page = pages[(id - 1) >> page_bits];
+    if (page == nullptr)
+        page = std::make_unique<Page>();
+
+    auto &table = (*page)[(id - 1) & (page_size - 1)];
+    if (!table.has_value())
+        table.emplace(id);
+
+    return table.value();
+}
+
+auto TableStore::find(std::size_t id) const -> const Table *
+{
+    const auto &page = pages[(id - 1) >> page_bits];
+    if (page == nullptr)
+        return nullptr;
+
+    const auto &table = (*page)[(id - 1) & (page_size - 1)];
+
+    return table.has_value() ? &table.value() : nullptr;
+}
+
 auto Event::operator<(const Event &other) const -> bool
 {
     return client_name[0] < other.client_name[0];
@@ -74,7 +127,7 @@ auto Event::from_parser(BasicParser &parser) -> bool
         return false;
     }
 
-    if (type < in_client_came_in || type > in_client_left)
+    if (type < in_client_came_in || type > in_client_reserve)
         return false;
 
     if (!parser.skip(' ')) {
@@ -89,7 +142,7 @@ auto Event::from_parser(BasicParser &parser) -> bool
 
     // ([TABLE_ID])
     std::optional<std::size_t> table_id = std::nullopt;
-    if (type.value() == in_client_sit) {
+    if (type.value() == in_client_sit || type.value() == in_client_reserve) {
         if (!parser.skip(' ')) {
             return false;
         }
@@ -108,6 +161,34 @@ auto Event::from_parser(BasicParser &parser) -> bool
     return true;
 }
 
+auto format_event(std::string &out, const Event &event) -> void
+{
+    // "HH:MM " + event id + ' ' + table id + '\n' always fit in here
+    char        buf[64];
+    std::size_t h, m;
+    timeutil::time_point_hm(event.time, h, m);
+
+    out.append(buf, snprintf(buf, sizeof(buf), "%02zu:%02zu %u ", h, m,
+                        event.type));
+
+    if (event.type == out_error) {
+        // critical errors have no code and, thus, no description
+        if (event.error_code.has_value())
+            out.append(computer_club_error_str[event.error_code.value()]);
+        out.push_back('\n');
+
+        return;
+    }
+
+    out.append(event.client_name);
+    out.push_back(' ');
+
+    if (event.table_id.has_value())
+        out.append(
+            buf, snprintf(buf, sizeof(buf), "%zu", event.table_id.value()));
+    out.push_back('\n');
+}
+
 // FORMAT: [TABLES COUNT] [NEW LINE]
 //         [TIME INTERVAL] [NEW LINE]
 //         [HOUR COST]
@@ -153,10 +234,19 @@ EventSystem::EventSystem(std::size_t tables_count,
     timeutil::TimeInterval work_hours, std::size_t hour_cost)
     : work_hours(work_hours)
     , hour_cost(hour_cost)
-    , clients(tables_count * 2)
+    , clients(std::min(tables_count, max_reserved_tables) * 2)
+    , tables(tables_count)
 {
-    for (std::size_t i = 1; i <= tables_count; ++i)
-        tables.emplace_back(i);
+}
+
+auto EventSystem::set_analytics(analytics::Analytics *collector) -> void
+{
+    this->collector = collector;
+}
+
+auto EventSystem::set_limits(const Limits &limits) -> void
+{
+    this->limits = limits;
 }
 
 auto EventSystem::is_queue_full() const -> bool
@@ -173,9 +263,49 @@ auto EventSystem::sit_client_table(std::string_view client_name, std::size_t id,
 {
     auto &client = clients[client_name];
 
+    if (collector != nullptr && client.state == client_state_awaits
+        && !client.gone)
+        collector->record_wait(client.awaits_since, time);
+
+    timers.cancel(client.queue_timer);
+    client.queue_timer = Timers::no_timer;
+
     client.table_id = id;
     client.state    = client_state_sits;
-    tables[id - 1].sit(time);
+    tables[id].sit(time);
+}
+
+auto EventSystem::leave_table(std::string_view client_name, std::size_t id,
+    timeutil::TimePoint time) -> void
+{
+    const auto cost = tables[id].leave(time, hour_cost);
+
+    if (collector != nullptr)
+        collector->record_charge(client_name, cost);
+}
+
+auto EventSystem::reserve(std::size_t id, std::string_view client_name)
+    -> Reservation &
+{
+    ++reserved_by[client_name];
+
+    auto &reservation       = reservations[id];
+    reservation.client_name = client_name;
+
+    return reservation;
+}
+
+auto EventSystem::unreserve(std::size_t id) -> void
+{
+    const auto it = reservations.find(id);
+    if (it == reservations.end())
+        return;
+
+    if (const auto by = reserved_by.find(it->second.client_name);
+        --by->second == 0)
+        reserved_by.erase(by);
+
+    reservations.erase(it);
 }
 
 auto EventSystem::handle_client_came_in(
@@ -203,10 +333,16 @@ auto EventSystem::handle_client_came_in(
         return;
     }
 
-    clients.insert({
-        event.client_name,
-        Client {},
-    });
+    auto &client = clients[event.client_name];
+    client.came_in = event.time;
+
+    if (limits.max_session.has_value())
+        client.session_timer
+            = timers.schedule(event.time + limits.max_session.value(),
+                Timer {
+                    .kind        = timer_session,
+                    .client_name = event.client_name,
+                });
 }
 
 auto EventSystem::handle_client_sit(
@@ -227,7 +363,18 @@ auto EventSystem::handle_client_sit(
             .type        = out_error,
             .client_name = event.client_name,
         };
-    } else if (tables[event.table_id.value() - 1].occupied()) {
+    } else if (!tables.contains(event.table_id.value())) {
+        // NOTE: same as above, there is no such table in the club
+        out_event = Event {
+            .time        = event.time,
+            .type        = out_error,
+            .client_name = event.client_name,
+        };
+    } else if (const Table *table = tables.find(event.table_id.value());
+               (table != nullptr && table->occupied())
+               || (reservations.contains(event.table_id.value())
+                   && reservations[event.table_id.value()].client_name
+                       != event.client_name)) {
         out_event = Event {
             .time        = event.time,
             .type        = out_error,
@@ -235,9 +382,16 @@ auto EventSystem::handle_client_sit(
             .error_code  = err_client_table_taken,
         };
     } else {
+        // the client takes the table reserved for them, if so
+        if (const auto it = reservations.find(event.table_id.value());
+            it != reservations.end()) {
+            timers.cancel(it->second.timer);
+            unreserve(it->first);
+        }
+
         auto client = clients[event.client_name];
         if (client.state == client_state_sits) {
-            tables[client.table_id.value() - 1].leave(event.time, hour_cost);
+            leave_table(event.client_name, client.table_id.value(), event.time);
         }
 
         const auto table_id = event.table_id.value();
@@ -270,8 +424,30 @@ auto EventSystem::handle_client_awaiting(
             .type        = out_client_left,
             .client_name = event.client_name,
         };
+
+        if (collector != nullptr)
+            collector->record_queue_request(true);
+
+        // NOTE: a client, who sits, keeps the table as before
+        if (clients[event.client_name].state != client_state_sits)
+            leave_without_table(event.client_name, event.time);
     } else {
-        clients[event.client_name].state = client_state_awaits;
+        auto &client        = clients[event.client_name];
+        client.state        = client_state_awaits;
+        client.awaits_since = event.time;
+
+        if (limits.queue_timeout.has_value()) {
+            timers.cancel(client.queue_timer);
+            client.queue_timer
+                = timers.schedule(event.time + limits.queue_timeout.value(),
+                    Timer {
+                        .kind        = timer_queue,
+                        .client_name = event.client_name,
+                    });
+        }
+
+        if (collector != nullptr)
+            collector->record_queue_request(false);
     }
 }
 
@@ -285,31 +461,150 @@ auto EventSystem::handle_client_left(
             .client_name = event.client_name,
             .error_code  = err_client_unknown,
         };
+    } else if (clients[event.client_name].state == client_state_sits) {
+        depart(event.client_name, event.time, out_event);
     } else {
-        if (clients[event.client_name].state == client_state_sits) {
-            Table &table
-                = tables[clients[event.client_name].table_id.value() - 1];
+        leave_without_table(event.client_name, event.time);
+    }
+}
 
-            table.leave(event.time, hour_cost);
-            clients.erase(event.client_name);
+auto EventSystem::handle_client_reserve(
+    const Event &event, std::optional<Event> &out_event) -> void
+{
+    // NOTE: the client does not have to be inside to make a reservation
+    if (!event.table_id.has_value()
+        || !tables.contains(event.table_id.value())) {
+        // NOTE: the same as with `in_client_sit`, there is no such table
+        out_event = Event {
+            .time        = event.time,
+            .type        = out_error,
+            .client_name = event.client_name,
+        };
+    } else if (const Table *table = tables.find(event.table_id.value());
+               (table != nullptr && table->occupied())
+               || reservations.contains(event.table_id.value())) {
+        out_event = Event {
+            .time        = event.time,
+            .type        = out_error,
+            .client_name = event.client_name,
+            .error_code  = err_client_table_taken,
+        };
+    } else {
+        const auto id = event.table_id.value();
+
+        auto &reservation = reserve(id, event.client_name);
+
+        if (limits.reservation_hold.has_value())
+            reservation.timer
+                = timers.schedule(event.time + limits.reservation_hold.value(),
+                    Timer {
+                        .kind        = timer_reservation,
+                        .client_name = event.client_name,
+                        .table_id    = id,
+                    });
+    }
+}
 
-            // find the first client from the queue
-            auto client = std::find_if(
-                clients.begin(), clients.end(), [](const auto &pair) {
-                    return pair.second.state == client_state_awaits;
-                });
+auto EventSystem::depart(std::string_view client_name,
+    timeutil::TimePoint time, std::optional<Event> &out_event) -> void
+{
+    const auto leaving = clients[client_name];
 
-            if (client != clients.end()) {
-                sit_client_table(client->first, table.get_id(), event.time);
+    timers.cancel(leaving.session_timer);
+    timers.cancel(leaving.queue_timer);
 
-                out_event = Event {
-                    .time        = event.time,
-                    .type        = out_client_sit,
-                    .client_name = client->first,
-                };
-            }
-        }
+    if (leaving.state == client_state_sits)
+        leave_table(client_name, leaving.table_id.value(), time);
+
+    if (collector != nullptr && !leaving.gone)
+        collector->record_session(client_name, leaving.came_in, time);
+
+    clients.erase(client_name);
+
+    if (leaving.state != client_state_sits)
+        return;
+
+    // find the first client from the queue
+    auto client
+        = std::find_if(clients.begin(), clients.end(), [](const auto &pair) {
+              return pair.second.state == client_state_awaits;
+          });
+
+    if (client != clients.end()) {
+        sit_client_table(client->first, leaving.table_id.value(), time);
+
+        out_event = Event {
+            .time        = time,
+            .type        = out_client_sit,
+            .client_name = client->first,
+        };
+    }
+}
+
+auto EventSystem::leave_without_table(
+    std::string_view client_name, timeutil::TimePoint time) -> void
+{
+    auto &leaving = clients[client_name];
+    if (leaving.gone)
+        return;
+
+    leaving.gone = true;
+
+    timers.cancel(leaving.session_timer);
+    timers.cancel(leaving.queue_timer);
+    leaving.session_timer = Timers::no_timer;
+    leaving.queue_timer   = Timers::no_timer;
+
+    if (collector != nullptr)
+        collector->record_session(client_name, leaving.came_in, time);
+}
+
+auto EventSystem::handle_timer(timeutil::TimePoint time, const Timer &timer,
+    std::vector<Event> &events) -> void
+{
+    std::optional<Event> out_event;
+
+    switch (timer.kind) {
+    case timer_session: {
+        clients[timer.client_name].session_timer = Timers::no_timer;
+
+        events.push_back(Event {
+            .time        = time,
+            .type        = out_session_over,
+            .client_name = timer.client_name,
+        });
+        depart(timer.client_name, time, out_event);
+        break;
+    }
+    case timer_queue: {
+        clients[timer.client_name].queue_timer = Timers::no_timer;
+
+        events.push_back(Event {
+            .time        = time,
+            .type        = out_queue_timeout,
+            .client_name = timer.client_name,
+        });
+        depart(timer.client_name, time, out_event);
+
+        if (collector != nullptr)
+            collector->record_queue_timeout();
+        break;
     }
+    case timer_reservation: {
+        unreserve(timer.table_id);
+
+        events.push_back(Event {
+            .time        = time,
+            .type        = out_reservation_expired,
+            .client_name = timer.client_name,
+            .table_id    = timer.table_id,
+        });
+        break;
+    }
+    }
+
+    if (out_event.has_value())
+        events.push_back(out_event.value());
 }
 
 auto EventSystem::handle_unexpected(std::optional<Event> &out_event) -> void
@@ -337,6 +632,10 @@ auto EventSystem::handle_event(Event &event, std::optional<Event> &out_event)
         handle_client_left(event, out_event);
         break;
     }
+    case in_client_reserve: {
+        handle_client_reserve(event, out_event);
+        break;
+    }
     default:
         // should never happen, otherwise it's an error
         handle_unexpected(out_event);
@@ -344,8 +643,23 @@ auto EventSystem::handle_event(Event &event, std::optional<Event> &out_event)
     }
 }
 
+auto EventSystem::fire_timers(
+    timeutil::TimePoint time, std::vector<Event> &events) -> void
+{
+    // nothing is due after the closing, whatever comes in afterwards
+    timers.advance(std::min(time, work_hours.end),
+        [this, &events](auto due, Timer &timer) {
+            handle_timer(due, timer, events);
+        });
+}
+
 auto EventSystem::kick_everyone_out(std::set<Event> &events) -> void
 {
+    // nothing is due after the closing
+    timers.clear();
+    reservations.clear();
+    reserved_by.clear();
+
     for (const auto &pair : clients) {
         events.insert(Event {
             .time        = work_hours.end,
@@ -354,23 +668,48 @@ auto EventSystem::kick_everyone_out(std::set<Event> &events) -> void
         });
 
         if (pair.second.table_id.has_value())
-            this->tables[pair.second.table_id.value() - 1].leave(
-                work_hours.end, hour_cost);
+            leave_table(
+                pair.first, pair.second.table_id.value(), work_hours.end);
+
+        if (collector != nullptr && !pair.second.gone)
+            collector->record_session(
+                pair.first, pair.second.came_in, work_hours.end);
     }
 
     clients.clear();
 }
 
-auto EventSystem::write_tables_stats(FILE *f) -> int
+auto EventSystem::write_tables_stats(FILE *f, bool used_only) -> int
 {
     bool err = false;
 
-    for (const Table &t : tables) {
+    const auto write = [&err, f](const Table &t) {
         err |= t.write_stats_to_file(f);
         err |= putc('\n', f);
+    };
+
+    if (used_only) {
+        tables.for_each(write);
+        return err;
+    }
+
+    // tables, which have never been used, are not materialized
+    for (std::size_t id = 1; id <= tables.size(); ++id) {
+        const Table *t = tables.find(id);
+        write(t != nullptr ? *t : Table { id });
     }
 
     return err;
 }
 
+auto EventSystem::client_bucket_count() const -> std::size_t
+{
+    return clients.bucket_count();
+}
+
+auto EventSystem::refers_to(std::string_view client_name) const -> bool
+{
+    return clients.contains(client_name) || reserved_by.contains(client_name);
+}
+
 } // namespace event_system
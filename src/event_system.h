@@ -1,14 +1,19 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
+#include <memory>
 #include <optional>
 #include <set>
+#include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "analytics.h"
 #include "parser.h"
 #include "timeutil.h"
+#include "timing_wheel.h"
 
 namespace event_system {
 
@@ -18,7 +23,9 @@ enum ComputerClubError {
     err_client_came_early,  // - caused when `in_client_came_in` event is called
                             // in the non-working hours
     err_client_table_taken, // - caused when `in_client_sit` is called, but a
-                            // table is already being used by other client
+                            // table is already being used by other client;
+                            // or when `in_client_reserve` is called on a
+                            // table, which is used or reserved
     err_client_unknown, // - caused when `in_client_sit` or `in_client_left` are
                         // called on wrong client
     err_client_awaits_nothing, // - caused when `in_client_awaiting` is called,
@@ -26,16 +33,25 @@ enum ComputerClubError {
                                // available
 };
 
+// simple map on string literals versions of the errors to be used in programs`
+// output
+extern const char *computer_club_error_str[];
+
 enum EventType {
     // events read by the program from the file:
     in_client_came_in  = 1,
     in_client_sit      = 2,
     in_client_awaiting = 3,
     in_client_left     = 4,
+    in_client_reserve  = 5,
     // events generated by the program:
     out_client_left    = 11,
     out_client_sit     = 12,
     out_error          = 13,
+    // events generated by the program on timers, see `Limits`:
+    out_session_over        = 14,
+    out_reservation_expired = 15,
+    out_queue_timeout       = 16,
 };
 
 class Table {
@@ -55,13 +71,57 @@ public:
 
     auto sit(timeutil::TimePoint time) -> void;
 
-    auto leave(timeutil::TimePoint time, std::size_t hour_cost) -> void;
+    // returns the amount charged for the time the table was sat on
+    auto leave(timeutil::TimePoint time, std::size_t hour_cost) -> std::size_t;
 
     auto write_stats_to_file(FILE *f) const -> int;
 
     [[nodiscard]] constexpr auto get_id() const -> std::size_t;
 };
 
+// Tables are kept in fixed-size pages, which are allocated on the first use of
+// any of their tables, so a club with large, but sparse table ids only pays
+// for the pages in use. Access by id is O(1), ids are in [1, size()].
+class TableStore {
+    static constexpr std::size_t page_bits = 8;
+    static constexpr std::size_t page_size = 1 << page_bits;
+
+    using Page = std::array<std::optional<Table>, page_size>;
+
+    std::size_t                        count;
+    std::vector<std::unique_ptr<Page>> pages;
+
+public:
+    explicit TableStore(std::size_t count);
+
+    [[nodiscard]] auto size() const -> std::size_t { return count; }
+
+    [[nodiscard]] auto contains(std::size_t id) const -> bool
+    {
+        return id >= 1 && id <= count;
+    }
+
+    // materializes the table on the first call, `id` has to be valid
+    auto operator[](std::size_t id) -> Table &;
+
+    // nullptr if the table has never been used
+    [[nodiscard]] auto find(std::size_t id) const -> const Table *;
+
+    // visits the tables, which have been used, in the order of their ids
+    template <typename F>
+    auto for_each(F &&f) const -> void
+    {
+        for (const auto &page : pages) {
+            if (page == nullptr)
+                continue;
+
+            for (const auto &table : *page)
+                if (table.has_value())
+                    f(table.value());
+        }
+    }
+};
+
 struct Event {
     timeutil::TimePoint              time;
     // NOTE: Events that have type `out_error` but have no error
@@ -76,9 +136,14 @@ struct Event {
 
     // FORMAT: [TIME POINT] [SPACE] [EVENT_ID] [SPACE] [CLIENT] [SPACE] \
     // ([TABLE_ID])
+    // NOTE: table id is there for `in_client_sit` and `in_client_reserve`
     auto from_parser(BasicParser &parser) -> bool;
 };
 
+// appends the event in the program's output format, including the trailing
+// '\n', to `out`
+auto format_event(std::string &out, const Event &event) -> void;
+
 struct Config {
     std::size_t            tables_count;
     timeutil::TimeInterval work_hours;
@@ -90,6 +155,35 @@ struct Config {
     auto from_parser(BasicParser &parser) -> bool;
 };
 
+// Time limits enforced by the club itself, in minutes; the ones not set are
+// not enforced. Those are not a part of the input, but of the program's
+// options.
+struct Limits {
+    // the client is made to leave after being that long in the club
+    // (`out_session_over`)
+    std::optional<std::size_t> max_session;
+    // the client, who has waited in the queue for that long, leaves
+    // (`out_queue_timeout`)
+    std::optional<std::size_t> queue_timeout;
+    // the reservation is cancelled, if the client does not sit at the table
+    // for that long (`out_reservation_expired`)
+    std::optional<std::size_t> reservation_hold;
+};
+
+enum TimerKind {
+    timer_session,
+    timer_queue,
+    timer_reservation,
+};
+
+struct Timer {
+    TimerKind        kind { timer_session };
+    std::string_view client_name {};
+    std::size_t      table_id { 0 }; // for `timer_reservation` only
+};
+
+using Timers = TimingWheel<Timer>;
+
 enum ClientState {
     client_state_inside,
     client_state_awaits,
@@ -99,24 +193,75 @@ enum ClientState {
 struct Client {
     std::optional<std::size_t> table_id {};
     ClientState                state { client_state_inside };
+    // needed for the analytics only
+    timeutil::TimePoint        came_in { 0 };
+    timeutil::TimePoint        awaits_since { 0 };
+    // the client left without a table (or was sent away from the full
+    // queue), but is kept until the closing as the output has always had
+    // them there; their session is over for the analytics and the timers
+    bool                       gone { false };
+
+    Timers::Handle session_timer { Timers::no_timer };
+    Timers::Handle queue_timer { Timers::no_timer };
+};
+
+struct Reservation {
+    std::string_view client_name;
+    Timers::Handle   timer { Timers::no_timer };
 };
 
 class EventSystem {
     std::unordered_map<std::string_view, Client> clients;
-    std::vector<Table>                           tables;
+    TableStore                                   tables;
     timeutil::TimeInterval                       work_hours;
     std::size_t                                  hour_cost;
+    analytics::Analytics                        *collector { nullptr };
+    Limits                                       limits {};
+    Timers                                       timers;
+    // table id -> reservation
+    std::unordered_map<std::size_t, Reservation> reservations;
+    // client name -> number of their reservations, so `refers_to` does not
+    // need to look through all of them
+    std::unordered_map<std::string_view, std::size_t> reserved_by;
 
 public:
     EventSystem(std::size_t tables_count, timeutil::TimeInterval work_hours,
         std::size_t hour_cost);
 
+    // applies to the clients and reservations, which come afterwards
+    auto set_limits(const Limits &limits) -> void;
+
+    // the collector is updated along the simulation, if set; it has to
+    // outlive the event system
+    auto set_analytics(analytics::Analytics *collector) -> void;
+
 private:
     auto is_queue_full() const -> bool;
 
+    // charges the client for the table and records the amount
+    auto leave_table(std::string_view client_name, std::size_t id,
+        timeutil::TimePoint time) -> void;
+
     auto sit_client_table(std::string_view client_name, std::size_t id,
         timeutil::TimePoint time) -> void;
 
+    auto reserve(std::size_t id, std::string_view client_name) -> Reservation &;
+
+    // does not cancel the reservation's timer
+    auto unreserve(std::size_t id) -> void;
+
+    // the client leaves the club; the table, if it was sitting at one, goes
+    // to the first client from the queue, which is reported in `out_event`
+    auto depart(std::string_view client_name, timeutil::TimePoint time,
+        std::optional<Event> &out_event) -> void;
+
+    // the client, who does not sit, leaves; see `Client::gone`
+    auto leave_without_table(std::string_view client_name,
+        timeutil::TimePoint time) -> void;
+
+    auto handle_timer(timeutil::TimePoint time, const Timer &timer,
+        std::vector<Event> &events) -> void;
+
     auto handle_client_came_in(
         const Event &event, std::optional<Event> &out_event) -> void;
 
@@ -129,6 +274,9 @@ private:
     auto handle_client_left(const Event &event, std::optional<Event> &out_event)
         -> void;
 
+    auto handle_client_reserve(
+        const Event &event, std::optional<Event> &out_event) -> void;
+
     auto handle_unexpected(std::optional<Event> &out_event) -> void;
 
 public:
@@ -136,9 +284,24 @@ public:
     // same event it got
     auto handle_event(Event &event, std::optional<Event> &out_event) -> void;
 
+    // fires the timers due at or before `time` in order, the events they
+    // generate are appended to `events`; has to be called before handling an
+    // event with the event's time and before the closing with its time
+    auto fire_timers(timeutil::TimePoint time, std::vector<Event> &events)
+        -> void;
+
     auto kick_everyone_out(std::set<Event> &events) -> void;
 
-    auto write_tables_stats(FILE *f) -> int;
+    // every table is written, unless `used_only`, then only the ones, which
+    // somebody sat at (for venues with sparse table ids)
+    auto write_tables_stats(FILE *f, bool used_only) -> int;
+
+    // used by the profiler to notice rehashes of `clients`
+    [[nodiscard]] auto client_bucket_count() const -> std::size_t;
+
+    // whether the client's name is still kept, i.e. the client is inside or
+    // holds a reservation; once it is not, the name's storage may be freed
+    [[nodiscard]] auto refers_to(std::string_view client_name) const -> bool;
 };
 
 } // namespace event_system;
@@ -0,0 +1,578 @@
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ingest.h"
+#include "memstats.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+
+namespace ingest {
+
+namespace {
+
+    // number of files being read at the same time by the io_uring backend
+    constexpr unsigned queue_depth = 64;
+    // single read request limit, the length field of the request is 32 bit
+    constexpr std::size_t max_read_size = 1 << 30;
+    // buffer for a file, which size is not known (pipes, procfs), or which
+    // grows while being read; doubled each time it gets full
+    constexpr std::size_t min_read_size = 4096;
+
+    // a byte more than the file's size, so the read returning 0 at the end
+    // does not grow (copy) the buffer; unknown sizes are grown on demand
+    auto initial_buffer_size(std::size_t file_size) -> std::size_t
+    {
+        return file_size == 0 ? 0 : file_size + 1;
+    }
+
+    struct Result {
+        char       *data { nullptr }; // allocated by `open_memstream`
+        std::size_t size { 0 };
+        bool        ready { false };
+        bool        ok { false };
+        int         error { 0 }; // the output could not be collected
+    };
+
+    // Runs the processor over the files' contents as they are delivered by
+    // the reading backend and keeps the outputs until they can be written
+    // in order.
+    class WorkerPool {
+        const Processor     &process;
+        std::vector<Result> &results;
+
+        std::mutex              mutex;
+        std::condition_variable job_cv;
+        std::condition_variable done_cv;
+
+        std::deque<std::pair<std::size_t, std::string>> jobs;
+        bool                                            closing { false };
+
+        std::vector<std::thread> threads;
+
+    public:
+        WorkerPool(const Processor &process, std::vector<Result> &results)
+            : process(process)
+            , results(results)
+        {
+            const auto n = std::max(1u, std::thread::hardware_concurrency());
+
+            for (unsigned i = 0; i < n; ++i)
+                threads.emplace_back([this] { work(); });
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard lock { mutex };
+                closing = true;
+            }
+            job_cv.notify_all();
+
+            for (auto &t : threads)
+                t.join();
+        }
+
+        auto submit(std::size_t index, std::string source) -> void
+        {
+            {
+                std::lock_guard lock { mutex };
+                jobs.emplace_back(index, std::move(source));
+            }
+            job_cv.notify_one();
+        }
+
+        // marks the file as the one, which could not be read
+        auto fail(std::size_t index) -> void
+        {
+            {
+                std::lock_guard lock { mutex };
+                results[index].ready = true;
+            }
+            done_cv.notify_all();
+        }
+
+        auto write_in_order(const std::vector<const char *> &paths, FILE *out)
+            -> bool
+        {
+            bool ok = true;
+
+            for (std::size_t i = 0; i < results.size(); ++i) {
+                std::unique_lock lock { mutex };
+                done_cv.wait(lock, [&] { return results[i].ready; });
+                lock.unlock();
+
+                Result &r = results[i];
+                if (!r.ok) {
+                    // read errors are reported as they happen
+                    if (r.error != 0)
+                        fprintf(stderr, "ERROR: cannot process file %s: %s\n",
+                            paths[i], strerror(r.error));
+
+                    free(r.data);
+                    r.data = nullptr;
+
+                    ok = false;
+                    continue;
+                }
+
+                fprintf(out, "%s==> %s <==\n", i == 0 ? "" : "\n", paths[i]);
+                fwrite(r.data, 1, r.size, out);
+
+                free(r.data);
+                r.data = nullptr;
+            }
+
+            return ok;
+        }
+
+    private:
+        auto work() -> void
+        {
+            for (;;) {
+                std::unique_lock lock { mutex };
+                job_cv.wait(lock, [this] { return closing || !jobs.empty(); });
+
+                if (jobs.empty())
+                    return;
+
+                auto [index, source] = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+
+                Result r {};
+                if (FILE *f = open_memstream(&r.data, &r.size)) {
+                    process(std::move(source), f);
+                    r.ok = fclose(f) == 0;
+                }
+                if (!r.ok)
+                    r.error = errno != 0 ? errno : EIO;
+
+                lock.lock();
+                r.ready        = true;
+                results[index] = r;
+                lock.unlock();
+
+                done_cv.notify_all();
+            }
+        }
+    };
+
+    auto report_failure(const char *path, int error) -> void
+    {
+        fprintf(stderr, "ERROR: cannot open file %s: %s\n", path,
+            strerror(error));
+    }
+
+    auto read_plain(const std::vector<const char *> &paths, WorkerPool &pool)
+        -> void
+    {
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            const int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                report_failure(paths[i], errno);
+                pool.fail(i);
+                continue;
+            }
+
+            struct stat st {};
+            std::string data;
+            if (fstat(fd, &st) == 0)
+                data.resize(initial_buffer_size(st.st_size));
+
+            std::size_t done = 0;
+            int         error = 0;
+
+            for (;;) {
+                if (done == data.size())
+                    data.resize(std::max(min_read_size, data.size() * 2));
+
+                const ssize_t n
+                    = read(fd, data.data() + done, data.size() - done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+
+                if (n <= 0) {
+                    error = n < 0 ? errno : 0;
+                    break;
+                }
+
+                done += n;
+            }
+
+            close(fd);
+            data.resize(done);
+
+            if (error != 0) {
+                report_failure(paths[i], error);
+                pool.fail(i);
+            } else {
+                pool.submit(i, std::move(data));
+            }
+        }
+    }
+
+#ifdef HAVE_IO_URING
+
+    // Minimal io_uring wrapper over the raw system calls, only what the
+    // backend needs: one submission queue and one completion queue.
+    class Ring {
+        int fd { -1 };
+
+        void       *sq_ring { MAP_FAILED };
+        void       *cq_ring { MAP_FAILED };
+        std::size_t sq_ring_size { 0 };
+        std::size_t cq_ring_size { 0 };
+
+        io_uring_sqe *sqes { static_cast<io_uring_sqe *>(MAP_FAILED) };
+        std::size_t   sqes_size { 0 };
+
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+
+        io_uring_cqe *cqes;
+
+        unsigned pending { 0 }; // queued, but not yet submitted requests
+
+    public:
+        ~Ring()
+        {
+            if (sqes != MAP_FAILED)
+                munmap(sqes, sqes_size);
+            if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+                munmap(cq_ring, cq_ring_size);
+            if (sq_ring != MAP_FAILED)
+                munmap(sq_ring, sq_ring_size);
+            if (fd >= 0)
+                close(fd);
+        }
+
+        auto setup(unsigned entries) -> bool
+        {
+            io_uring_params p {};
+
+            fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+            if (fd < 0)
+                return false;
+
+            sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+            const bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+            if (single_mmap)
+                sq_ring_size = cq_ring_size
+                    = std::max(sq_ring_size, cq_ring_size);
+
+            sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sq_ring == MAP_FAILED)
+                return false;
+
+            cq_ring = single_mmap
+                ? sq_ring
+                : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED)
+                return false;
+
+            sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            sqes      = static_cast<io_uring_sqe *>(
+                mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+            if (sqes == MAP_FAILED)
+                return false;
+
+            auto *sq = static_cast<char *>(sq_ring);
+            sq_head  = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+            sq_tail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            sq_mask  = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+
+            auto *cq = static_cast<char *>(cq_ring);
+            cq_head  = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            cq_tail  = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            cq_mask  = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            cqes     = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+            return true;
+        }
+
+        // older kernels have io_uring, but not every operation we need
+        auto supports(std::initializer_list<unsigned> ops) const -> bool
+        {
+            constexpr unsigned max_ops = 256;
+
+            std::vector<char> buf(
+                sizeof(io_uring_probe) + max_ops * sizeof(io_uring_probe_op));
+            auto *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                    probe, max_ops)
+                < 0)
+                return false;
+
+            return std::all_of(ops.begin(), ops.end(), [&](unsigned op) {
+                return op <= probe->last_op
+                    && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+            });
+        }
+
+        // the caller never has more requests in flight than the queue holds,
+        // so there is always a free entry
+        auto next_sqe() -> io_uring_sqe *
+        {
+            const unsigned tail  = *sq_tail;
+            const unsigned index = tail & *sq_mask;
+
+            io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            ++pending;
+
+            return sqe;
+        }
+
+        // submits queued requests and blocks until at least one completes
+        auto submit_and_wait() -> bool
+        {
+            for (;;) {
+                const long r = syscall(__NR_io_uring_enter, fd, pending, 1,
+                    IORING_ENTER_GETEVENTS, nullptr, 0);
+
+                if (r >= 0) {
+                    pending -= static_cast<unsigned>(r);
+                    return true;
+                }
+
+                if (errno != EINTR && errno != EAGAIN)
+                    return false;
+            }
+        }
+
+        template <typename F>
+        auto reap(F &&on_completion) -> void
+        {
+            unsigned       head = *cq_head;
+            const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; ++head) {
+                const io_uring_cqe &cqe = cqes[head & *cq_mask];
+                on_completion(cqe.user_data, cqe.res);
+            }
+
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+    };
+
+    // A file going through open -> statx -> read(s); each stage is one
+    // request, the slot's index is the request's user data.
+    struct FileRead {
+        enum Stage { stage_open, stage_statx, stage_read };
+
+        std::size_t index;
+        Stage       stage;
+        int         fd;
+
+        struct statx stx;
+        std::string  data;
+        std::size_t  done;
+    };
+
+    class UringReader {
+        Ring                                 ring;
+        const std::vector<const char *>     &paths;
+        WorkerPool                          &pool;
+        std::vector<FileRead>                slots;
+        std::size_t                          next_file { 0 };
+        unsigned                             in_flight { 0 };
+
+    public:
+        UringReader(const std::vector<const char *> &paths, WorkerPool &pool)
+            : paths(paths)
+            , pool(pool)
+            , slots(queue_depth)
+        {
+        }
+
+        auto setup() -> bool
+        {
+            return ring.setup(queue_depth)
+                && ring.supports(
+                    { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ });
+        }
+
+        auto run() -> void
+        {
+            for (std::size_t slot = 0; slot < slots.size(); ++slot)
+                start(slot);
+
+            while (in_flight > 0) {
+                if (!ring.submit_and_wait()) {
+                    perror("ERROR: io_uring_enter");
+                    abort(); // requests in flight point into our buffers
+                }
+
+                ring.reap([this](std::uint64_t slot, int res) {
+                    --in_flight;
+                    complete(slot, res);
+                });
+            }
+        }
+
+    private:
+        auto start(std::size_t slot) -> void
+        {
+            if (next_file == paths.size())
+                return;
+
+            FileRead &f = slots[slot];
+            f.index     = next_file++;
+            f.stage     = FileRead::stage_open;
+            f.fd        = -1;
+            f.data.clear();
+            f.done = 0;
+
+            io_uring_sqe *sqe = ring.next_sqe();
+            sqe->opcode       = IORING_OP_OPENAT;
+            sqe->fd           = AT_FDCWD;
+            sqe->addr         = reinterpret_cast<std::uint64_t>(paths[f.index]);
+            sqe->open_flags   = O_RDONLY | O_CLOEXEC;
+            sqe->user_data    = slot;
+            ++in_flight;
+        }
+
+        // reads are issued until one returns 0, the same as `read_plain`
+        // does, so the size from statx is only a hint
+        auto queue_read(std::size_t slot) -> void
+        {
+            FileRead &f = slots[slot];
+            f.stage     = FileRead::stage_read;
+
+            if (f.done == f.data.size())
+                f.data.resize(std::max(min_read_size, f.data.size() * 2));
+
+            io_uring_sqe *sqe = ring.next_sqe();
+            sqe->opcode       = IORING_OP_READ;
+            sqe->fd           = f.fd;
+            sqe->addr = reinterpret_cast<std::uint64_t>(f.data.data() + f.done);
+            sqe->len  = static_cast<std::uint32_t>(
+                std::min(f.data.size() - f.done, max_read_size));
+            // -1 reads at the file's position, which works for pipes as well
+            sqe->off       = static_cast<std::uint64_t>(-1);
+            sqe->user_data = slot;
+            ++in_flight;
+        }
+
+        auto finish(std::size_t slot, int error) -> void
+        {
+            FileRead &f = slots[slot];
+
+            if (f.fd >= 0)
+                close(f.fd);
+
+            if (error != 0) {
+                report_failure(paths[f.index], error);
+                pool.fail(f.index);
+            } else {
+                f.data.resize(f.done);
+                pool.submit(f.index, std::move(f.data));
+            }
+
+            start(slot);
+        }
+
+        auto complete(std::size_t slot, int res) -> void
+        {
+            FileRead &f = slots[slot];
+
+            if (res < 0) {
+                finish(slot, -res);
+                return;
+            }
+
+            switch (f.stage) {
+            case FileRead::stage_open: {
+                f.fd = res;
+                f.stage = FileRead::stage_statx;
+
+                io_uring_sqe *sqe = ring.next_sqe();
+                sqe->opcode       = IORING_OP_STATX;
+                sqe->fd           = f.fd;
+                sqe->addr         = reinterpret_cast<std::uint64_t>("");
+                sqe->len          = STATX_SIZE;
+                sqe->statx_flags  = AT_EMPTY_PATH;
+                sqe->off          = reinterpret_cast<std::uint64_t>(&f.stx);
+                sqe->user_data    = slot;
+                ++in_flight;
+                break;
+            }
+            case FileRead::stage_statx: {
+                // zero for pipes and procfs files, they are read until the end
+                // all the same
+                f.data.resize(initial_buffer_size(f.stx.stx_size));
+                queue_read(slot);
+                break;
+            }
+            case FileRead::stage_read: {
+                f.done += res;
+
+                if (res == 0)
+                    finish(slot, 0);
+                else
+                    queue_read(slot);
+                break;
+            }
+            }
+        }
+    };
+
+#endif
+
+} // namespace
+
+auto process_files(const std::vector<const char *> &paths,
+    const Processor &process, FILE *out, bool prefer_io_uring) -> bool
+{
+    std::vector<Result> results(paths.size());
+
+    WorkerPool pool { process, results };
+
+    memstats::Scope scope { memstats::phase_read };
+
+    bool read = false;
+
+#ifdef HAVE_IO_URING
+    if (prefer_io_uring) {
+        UringReader reader { paths, pool };
+
+        if (reader.setup()) {
+            reader.run();
+            read = true;
+        }
+    }
+#endif
+
+    if (!read)
+        read_plain(paths, pool);
+
+    return pool.write_in_order(paths, out);
+}
+
+} // namespace ingest
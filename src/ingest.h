@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ingest {
+
+// runs the club over one file's contents, writing the program's output to
+// `out`
+using Processor = std::function<void(std::string source, FILE *out)>;
+
+// Reads every file in `paths` and runs `process` on their contents on a pool
+// of worker threads as soon as each read completes. The outputs are written
+// to `out` in the order of `paths`, each one preceded by a `==> PATH <==`
+// header line.
+//
+// The io_uring backend (Linux 5.6+) keeps many files' reads in flight at once,
+// it is used when `prefer_io_uring` is set and the kernel supports it,
+// otherwise the files are read one by one with plain `read()`. Returns false
+// if any of the files could not be read, the rest are processed regardless.
+auto process_files(const std::vector<const char *> &paths,
+    const Processor &process, FILE *out, bool prefer_io_uring = true) -> bool;
+
+} // namespace ingest
@@ -1,3 +1,4 @@
+#include <charconv>
 #include <cstdio>
 #include <ios>
 #include <iostream>
@@ -7,9 +8,15 @@
 #include <optional>
 #include <set>
 #include <string_view>
+#include <vector>
 
+#include "club.h"
 #include "event_system.h"
+#include "ingest.h"
+#include "memstats.h"
 #include "parser.h"
+#include "server.h"
+#include "shard.h"
 #include "timeutil.h"
 
 #if defined(__gnu_linux__) || defined(_SYSTYPE_BSD)
@@ -17,20 +24,11 @@
 #else
 #define EX_OK 0 /* successful termination */
 
-#define EX_USAGE 64 /* command line usage error */
-#define EX_IOERR 74 /* input/output error */
+#define EX_USAGE   64 /* command line usage error */
+#define EX_DATAERR 65 /* data format error */
+#define EX_IOERR   74 /* input/output error */
 #endif
 
-// simple map on string literals versions of the errors to be used in programs`
-// output
-const char *computer_clib_error_str[] = {
-    "YouShallNotPass",
-    "NotOpenYet",
-    "PlaceIsBusy",
-    "ClientUnknown",
-    "ICanWaitNoLonger!",
-};
-
 auto read_file(std::string &str, const char *path) -> bool
 {
     std::ifstream t(path);
@@ -47,86 +45,202 @@ auto read_file(std::string &str, const char *path) -> bool
     return true;
 }
 
-auto main(int argc, char **argv) -> int
+auto parse_minutes(const char *arg, std::optional<std::size_t> &minutes)
+    -> bool
 {
-    if (argc < 2) {
-        fprintf(stderr,
-            "USAGE ERROR: no file path supplied\n"
-            "USAGE:\n\t%s <path_to_file>\n",
-            argv[0]);
+    const std::string_view s { arg };
 
-        return EX_USAGE;
-    }
+    std::size_t n   = 0;
+    const auto  res = std::from_chars(s.data(), s.data() + s.size(), n);
+    if (res.ec != std::errc {} || res.ptr != s.data() + s.size())
+        return false;
 
+    minutes = n;
+
+    return true;
+}
+
+// `trial [OPTIONS] --daemon <path_to_socket> <path_to_config>`, where config
+// is a file in the usual format, from which only the first three lines are
+// used; of the options only the time limits and `--used-tables` apply
+auto run_daemon(const char *socket_path, const char *config_path,
+    const club::Options &options) -> int
+{
     std::string source;
-    if (!read_file(source, argv[1])) {
-        fprintf(stderr, "ERROR: cannot open file %s\n", argv[1]);
+    if (!read_file(source, config_path)) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", config_path);
 
         return EX_IOERR;
     }
 
-    BasicParser parser(source);
+    BasicParser parser(std::move(source));
+
+    event_system::Config cfg {};
+    if (!cfg.from_parser(parser)) {
+        fprintf(stderr, "ERROR: malformed config in %s\n", config_path);
+
+        return EX_DATAERR;
+    }
+
+    return server::run(socket_path, cfg, options) ? EX_OK : EX_IOERR;
+}
 
+// runs the club over the events left in `parser` after the config
+auto run_club(BasicParser &parser, FILE *out, const club::Options &options)
+    -> void
+{
     event_system::Config cfg {};
-    cfg.from_parser(parser);
+    {
+        memstats::Scope scope { memstats::phase_parse };
+        cfg.from_parser(parser);
+    }
+
+    memstats::Scope scope { memstats::phase_simulate };
+
+    club::Session session { cfg, out, options };
 
-    event_system::EventSystem system {
-        cfg.tables_count,
-        cfg.work_hours,
-        cfg.hour_cost,
+    const auto next_event = [&parser](event_system::Event &e) {
+        memstats::Scope scope { memstats::phase_parse };
+        return parser.skip('\n') && e.from_parser(parser);
     };
 
-    std::size_t h, m;
-    timeutil::time_point_hm(cfg.work_hours.begin, h, m);
+    for (event_system::Event e {}; next_event(e);)
+        session.handle(e);
+
+    session.close();
+}
+
+auto run_file(const char *path, const club::Options &options) -> int
+{
+    std::string source;
+    {
+        memstats::Scope scope { memstats::phase_read };
+
+        if (!read_file(source, path)) {
+            fprintf(stderr, "ERROR: cannot open file %s\n", path);
 
-    printf("%02zu:%02zu\n", h, m);
+            return EX_IOERR;
+        }
+    }
 
-    for (event_system::Event e {};
-         parser.skip('\n') && e.from_parser(parser);) {
+    std::optional<BasicParser> parser;
+    {
+        memstats::Scope scope { memstats::phase_parse };
+        parser.emplace(source);
+    }
 
-        timeutil::time_point_hm(e.time, h, m);
+    run_club(parser.value(), stdout, options);
 
-        printf("%02zu:%02zu %u %.*s ", h, m, e.type,
-            (int)e.client_name.length(), e.client_name.data());
-        if (e.table_id.has_value())
-            printf("%llu", e.table_id.value());
-        printf("\n");
+    return EX_OK;
+}
 
-        std::optional<event_system::Event> out_e;
-        system.handle_event(e, out_e);
+auto run_files(const std::vector<const char *> &paths, bool prefer_io_uring,
+    const club::Options &options) -> int
+{
+    const bool ok = ingest::process_files(
+        paths,
+        [&options](std::string source, FILE *out) {
+            memstats::Scope scope { memstats::phase_parse };
 
-        if (!out_e.has_value())
-            continue;
+            BasicParser parser(std::move(source));
+            run_club(parser, out, options);
+        },
+        stdout, prefer_io_uring);
 
-        e = out_e.value();
+    return ok ? EX_OK : EX_IOERR;
+}
 
-        timeutil::time_point_hm(e.time, h, m);
+// `trial --clubs <output_dir> <path_to_stream>`, see `shard.h` for the format
+auto run_clubs(const char *path, const char *out_dir,
+    const club::Options &options) -> int
+{
+    std::string source;
+    {
+        memstats::Scope scope { memstats::phase_read };
 
-        if (e.type == event_system::out_error)
-            printf("%02zu:%02zu %u %s\n", h, m, e.type,
-                computer_clib_error_str[e.error_code.value()]);
-        else {
-            printf("%02zu:%02zu %u %.*s ", h, m, e.type,
-                (int)e.client_name.length(), e.client_name.data());
+        if (!read_file(source, path)) {
+            fprintf(stderr, "ERROR: cannot open file %s\n", path);
 
-            if (e.table_id.has_value())
-                printf("%llu", e.table_id.value());
-            printf("\n");
+            return EX_IOERR;
         }
     }
 
-    std::set<event_system::Event> last_events;
-    system.kick_everyone_out(last_events);
+    return shard::run(source, out_dir, options) ? EX_OK : EX_DATAERR;
+}
+
+auto main(int argc, char **argv) -> int
+{
+    bool prefer_io_uring = true;
+    bool mem_stats       = false;
+
+    club::Options options {};
+
+    const char *clubs_dir   = nullptr;
+    const char *socket_path = nullptr;
+    bool        ok          = true;
+
+    std::vector<const char *> paths;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg { argv[i] };
+
+        if (arg == "--no-io-uring")
+            prefer_io_uring = false;
+        else if (arg == "--mem-stats")
+            mem_stats = true;
+        else if (arg == "--analytics")
+            options.with_analytics = true;
+        else if (arg == "--used-tables")
+            options.used_tables_only = true;
+        else if (arg == "--clubs" && i + 1 < argc)
+            clubs_dir = argv[++i];
+        else if (arg == "--daemon" && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (arg == "--max-session" && i + 1 < argc)
+            ok &= parse_minutes(argv[++i], options.limits.max_session);
+        else if (arg == "--queue-timeout" && i + 1 < argc)
+            ok &= parse_minutes(argv[++i], options.limits.queue_timeout);
+        else if (arg == "--reservation-hold" && i + 1 < argc)
+            ok &= parse_minutes(argv[++i], options.limits.reservation_hold);
+        else
+            paths.push_back(argv[i]);
+    }
+
+    // both `--clubs` and `--daemon` take a single file
+    const bool single_file = clubs_dir != nullptr || socket_path != nullptr;
 
-    timeutil::time_point_hm(cfg.work_hours.end, h, m);
+    if (!ok || paths.empty() || (single_file && paths.size() > 1)
+        || (clubs_dir != nullptr && socket_path != nullptr)) {
+        fprintf(stderr,
+            "USAGE ERROR: no file path supplied or wrong options\n"
+            "USAGE:\n\t%s [OPTIONS] <path_to_file>...\n"
+            "\t%s [OPTIONS] --clubs <output_dir> <path_to_stream>\n"
+            "\t%s [OPTIONS] --daemon <path_to_socket> <path_to_config>\n"
+            "OPTIONS:\n"
+            "\t--no-io-uring --mem-stats --analytics --used-tables\n"
+            "\t--max-session <minutes> --queue-timeout <minutes>\n"
+            "\t--reservation-hold <minutes>\n",
+            argv[0], argv[0], argv[0]);
+
+        return EX_USAGE;
+    }
 
-    for (const auto &e : last_events)
-        printf("%02zu:%02zu %u %.*s\n", h, m, e.type,
-            (int)e.client_name.length(), e.client_name.data());
+    if (socket_path != nullptr)
+        return run_daemon(socket_path, paths[0], options);
 
-    printf("%02zu:%02zu\n", h, m);
+    if (mem_stats)
+        memstats::enable();
 
-    system.write_tables_stats(stdout);
+    int code;
+    if (clubs_dir != nullptr)
+        code = run_clubs(paths[0], clubs_dir, options);
+    else if (paths.size() > 1)
+        code = run_files(paths, prefer_io_uring, options);
+    else
+        code = run_file(paths[0], options);
 
-    return EX_OK;
+    // NOTE: printed to `stderr` to keep the program's output intact
+    if (mem_stats)
+        memstats::write_report(stderr);
+
+    return code;
 }
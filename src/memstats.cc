@@ -0,0 +1,254 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "memstats.h"
+
+namespace memstats {
+
+namespace {
+
+    struct Counters {
+        std::atomic<std::size_t> allocs { 0 };
+        std::atomic<std::size_t> frees { 0 };
+        std::atomic<std::size_t> bytes { 0 };     // requested by allocations
+        std::atomic<std::size_t> rehashes { 0 };
+        std::atomic<std::size_t> peak_heap { 0 }; // live heap bytes
+        std::atomic<std::size_t> peak_rss { 0 };  // KiB, sampled
+    };
+
+    const char *phase_str[] = {
+        "other",
+        "read",
+        "parse",
+        "simulate",
+        "close-out",
+        "report",
+    };
+
+    std::atomic<bool> enabled { false };
+
+    Counters counters[phase_count];
+
+    // NOTE: signed, as blocks allocated before `enable` might be freed after
+    std::atomic<std::int64_t> live_bytes { 0 };
+
+    // Current RSS is sampled when a phase is entered and left, and whenever
+    // live heap grows by another step past the last sample, so a phase gets
+    // the highest RSS seen while it was running. `getrusage` only knows the
+    // peak of the whole process so far, which is not attributable to phases.
+    constexpr std::int64_t    rss_sample_step = 1 << 20;
+    std::atomic<std::int64_t> sampled_live { 0 };
+
+    int         statm_fd { -1 }; // kept open, so a sample is a single `pread`
+    std::size_t page_kib { 4 };
+
+    thread_local Phase current = phase_other;
+
+    auto raise(std::atomic<std::size_t> &peak, std::size_t value) -> void
+    {
+        auto p = peak.load(std::memory_order_relaxed);
+        while (value > p
+            && !peak.compare_exchange_weak(p, value, std::memory_order_relaxed))
+            ;
+    }
+
+    // the size is only known with glibc, elsewhere live heap is not tracked
+    auto block_size(void *p) -> std::size_t
+    {
+#ifdef __GLIBC__
+        return malloc_usable_size(p);
+#else
+        return 0;
+#endif
+    }
+
+    // resident set size in KiB, 0 if unknown; does not allocate, as it is
+    // called from `operator new`
+    auto current_rss_kib() -> std::size_t
+    {
+        if (statm_fd < 0)
+            return 0;
+
+        // FORMAT: [SIZE] [SPACE] [RESIDENT] [SPACE] ..., in pages
+        char          buf[128];
+        const ssize_t n = pread(statm_fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0)
+            return 0;
+        buf[n] = '\0';
+
+        const char *resident = buf;
+        while (*resident != '\0' && *resident != ' ')
+            ++resident;
+
+        return std::strtoull(resident, nullptr, 10) * page_kib;
+    }
+
+    auto sample_rss(Phase phase) -> void
+    {
+        raise(counters[phase].peak_rss, current_rss_kib());
+    }
+
+    auto on_alloc(void *p, std::size_t n) -> void
+    {
+        Counters &c = counters[current];
+
+        c.allocs.fetch_add(1, std::memory_order_relaxed);
+        c.bytes.fetch_add(n, std::memory_order_relaxed);
+
+        const auto size = static_cast<std::int64_t>(block_size(p));
+        const auto live
+            = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        if (live > 0)
+            raise(c.peak_heap, static_cast<std::size_t>(live));
+
+        auto last = sampled_live.load(std::memory_order_relaxed);
+        if (live - last >= rss_sample_step
+            && sampled_live.compare_exchange_strong(
+                last, live, std::memory_order_relaxed))
+            sample_rss(current);
+    }
+
+    auto on_free(void *p) -> void
+    {
+        counters[current].frees.fetch_add(1, std::memory_order_relaxed);
+
+        // a large block is touched only after it is allocated, so it shows in
+        // RSS by the time it is freed
+        const auto size = static_cast<std::int64_t>(block_size(p));
+        if (size >= rss_sample_step)
+            sample_rss(current);
+
+        const auto live
+            = live_bytes.fetch_sub(size, std::memory_order_relaxed) - size;
+
+        // the heap might grow back into the freed memory, which is sampled
+        // from the lowered mark then
+        auto last = sampled_live.load(std::memory_order_relaxed);
+        while (live < last
+            && !sampled_live.compare_exchange_weak(
+                last, live, std::memory_order_relaxed))
+            ;
+    }
+
+} // namespace
+
+auto enable() -> void
+{
+    // NOTE: Linux only, elsewhere RSS is reported as 0
+    statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+    if (const long page = sysconf(_SC_PAGESIZE); page > 0)
+        page_kib = static_cast<std::size_t>(page) / 1024;
+
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+Scope::Scope(Phase phase)
+    : previous(current)
+{
+    current = phase;
+
+    if (enabled.load(std::memory_order_relaxed))
+        sample_rss(current);
+}
+
+Scope::~Scope()
+{
+    if (enabled.load(std::memory_order_relaxed))
+        sample_rss(current);
+
+    current = previous;
+}
+
+auto record_rehash() -> void
+{
+    if (enabled.load(std::memory_order_relaxed))
+        counters[current].rehashes.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto write_report(FILE *f) -> void
+{
+    fprintf(f, "%-10s %10s %10s %12s %9s %12s %14s\n", "PHASE", "ALLOCS",
+        "FREES", "BYTES", "REHASHES", "PEAK HEAP", "PEAK RSS KiB");
+
+    for (int i = 0; i < phase_count; ++i) {
+        const Counters &c = counters[i];
+
+        fprintf(f, "%-10s %10zu %10zu %12zu %9zu %12zu %14zu\n", phase_str[i],
+            c.allocs.load(), c.frees.load(), c.bytes.load(), c.rehashes.load(),
+            c.peak_heap.load(), c.peak_rss.load());
+    }
+}
+
+} // namespace memstats
+
+auto operator new(std::size_t n) -> void *
+{
+    void *p;
+    while ((p = std::malloc(n != 0 ? n : 1)) == nullptr) {
+        const auto handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+
+        handler();
+    }
+
+    if (memstats::enabled.load(std::memory_order_relaxed))
+        memstats::on_alloc(p, n);
+
+    return p;
+}
+
+auto operator delete(void *p) noexcept -> void
+{
+    if (p != nullptr && memstats::enabled.load(std::memory_order_relaxed))
+        memstats::on_free(p);
+
+    std::free(p);
+}
+
+auto operator delete(void *p, std::size_t) noexcept -> void
+{
+    operator delete(p);
+}
+
+// over-aligned types (e.g. ones with `alignas(64)` members) come here instead
+auto operator new(std::size_t n, std::align_val_t alignment) -> void *
+{
+    const auto align = static_cast<std::size_t>(alignment);
+    // `aligned_alloc` wants the size to be a multiple of the alignment
+    const auto size = ((n != 0 ? n : 1) + align - 1) / align * align;
+
+    void *p;
+    while ((p = std::aligned_alloc(align, size)) == nullptr) {
+        const auto handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+
+        handler();
+    }
+
+    if (memstats::enabled.load(std::memory_order_relaxed))
+        memstats::on_alloc(p, n);
+
+    return p;
+}
+
+auto operator delete(void *p, std::align_val_t) noexcept -> void
+{
+    operator delete(p);
+}
+
+auto operator delete(void *p, std::size_t, std::align_val_t) noexcept -> void
+{
+    operator delete(p);
+}
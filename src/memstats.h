@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+// Allocation profiler: the global `operator new`/`operator delete` are
+// replaced to count allocations on behalf of the phase the calling thread is
+// in. Counting is off until `enable` is called, so normal runs only pay for a
+// single branch per allocation.
+namespace memstats {
+
+enum Phase {
+    phase_other, // anything outside of the phases below
+    phase_read,
+    phase_parse,
+    phase_simulate,
+    phase_close_out,
+    phase_report,
+    phase_count,
+};
+
+auto enable() -> void;
+
+// sets the phase of the calling thread for the lifetime of the scope, the
+// previous one is restored afterwards
+class Scope {
+    Phase previous;
+
+public:
+    explicit Scope(Phase phase);
+    ~Scope();
+
+    Scope(const Scope &)                     = delete;
+    auto operator=(const Scope &) -> Scope & = delete;
+};
+
+// called whenever a hash table grows its buckets during the current phase
+auto record_rehash() -> void;
+
+auto write_report(FILE *f) -> void;
+
+} // namespace memstats
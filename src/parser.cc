@@ -11,7 +11,14 @@ inline auto BasicParser::is_word(const char c) -> bool
 }
 
 BasicParser::BasicParser(std::string source)
-    : source(std::move(source))
+    : storage(std::move(source))
+    , source(storage)
+    , pointer(this->source.cbegin())
+{
+}
+
+BasicParser::BasicParser(std::string_view source)
+    : source(source)
     , pointer(this->source.cbegin())
 {
 }
@@ -19,12 +26,24 @@ BasicParser::BasicParser(std::string source)
 // needed to check for '\n' and ' ' between tokens
 auto BasicParser::skip(const char expected) -> bool
 {
-    bool result = *pointer == expected;
+    // NOTE: pointer is left in place on mismatch, so that a failed parse never
+    // goes past the end of the line it has started on
+    if (pointer == source.cend() || *pointer != expected)
+        return false;
+
     ++pointer;
 
-    return result;
+    return true;
 }
 
+auto BasicParser::skip_line() -> void
+{
+    while (pointer != source.cend() && *pointer++ != '\n')
+        ;
+}
+
+auto BasicParser::eof() const -> bool { return pointer == source.cend(); }
+
 auto BasicParser::number() -> std::optional<std::size_t>
 {
     std::optional<std::size_t> result {};
@@ -8,8 +8,9 @@
 #include "timeutil.h"
 
 class BasicParser {
-    std::string                 source;
-    std::string::const_iterator pointer;
+    std::string                      storage; // empty, if source is borrowed
+    std::string_view                 source;
+    std::string_view::const_iterator pointer;
 
     // reson to create local is_digit, is because the cctype one does also
     // include characters 'a'..'z' for hex nums
@@ -19,9 +20,20 @@ class BasicParser {
 
 public:
     explicit BasicParser(std::string source);
+    // parses `source` in place, without a copy; it has to outlive the parser
+    // and the words it returns
+    explicit BasicParser(std::string_view source);
+
+    // `source` and `pointer` refer to `storage`
+    BasicParser(const BasicParser &)                     = delete;
+    auto operator=(const BasicParser &) -> BasicParser & = delete;
 
     // needed to check for '\n' and ' ' between tokens
     auto skip(char expected) -> bool;
+    // skips everything up to and including the next '\n', used to recover
+    // from a malformed line
+    auto skip_line() -> void;
+    [[nodiscard]] auto eof() const -> bool;
     auto number() -> std::optional<std::size_t>;
     // FORMAT: HH [COLON] MM
     auto time_point() -> std::optional<timeutil::TimePoint>;
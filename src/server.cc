@@ -0,0 +1,546 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "server.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace server {
+
+#ifdef __linux__
+
+namespace {
+
+    constexpr int         max_epoll_events = 64;
+    constexpr std::size_t read_chunk_size  = 64 * 1024;
+    // a connection is read at most that many chunks per wake up, so a busy
+    // producer can not starve the others; the rest stays readable and is
+    // picked up on the next wake up
+    constexpr std::size_t max_reads_per_wake_up = 16;
+    // producers which send longer lines (or never end them) are dropped
+    constexpr std::size_t max_line_size = 64 * 1024;
+    // subscribers which do not keep up with the stream are dropped instead of
+    // buffering for them indefinitely
+    constexpr std::size_t max_pending_bytes = 16 * 1024 * 1024;
+
+    constexpr std::string_view subscribe_command = "subscribe";
+
+    struct Connection {
+        std::string in;  // received bytes, which do not form a full line yet
+        std::string out; // bytes not yet accepted by the socket
+        bool        subscribed { false };
+        bool        wants_write { false };
+    };
+
+    // needed for the lookups by `std::string_view` without a temporary string
+    struct NameHash {
+        using is_transparent = void;
+
+        auto operator()(std::string_view s) const -> std::size_t
+        {
+            return std::hash<std::string_view> {}(s);
+        }
+    };
+
+    class Daemon {
+        int listen_fd { -1 };
+        int signal_fd { -1 };
+        int epoll_fd { -1 };
+
+        std::unordered_map<int, Connection> connections;
+
+        // `EventSystem` keeps `std::string_view`s of client names, while the
+        // lines they came from are gone after each batch, so the names are
+        // stored here for as long as the event system refers to them
+        std::unordered_set<std::string, NameHash, std::equal_to<>> names;
+
+        std::string batch;    // complete lines gathered during one wake up
+        std::string outgoing; // events produced by the last batch
+
+        std::vector<event_system::Event> fired; // reused for the timers' events
+        // names of the events handled since the last `release_names`
+        std::vector<std::string_view> touched;
+
+        timeutil::TimePoint       closing_time;
+        bool                      used_tables_only;
+        // producers are independent, so nothing orders their events, while
+        // the event system relies on the time never going back
+        timeutil::TimePoint       last_time { 0 };
+        event_system::EventSystem system;
+
+    public:
+        Daemon(const event_system::Config &cfg, const club::Options &options)
+            : closing_time(cfg.work_hours.end)
+            , used_tables_only(options.used_tables_only)
+            , system(cfg.tables_count, cfg.work_hours, cfg.hour_cost)
+        {
+            system.set_limits(options.limits);
+        }
+
+        ~Daemon()
+        {
+            for (const auto &pair : connections)
+                close(pair.first);
+
+            for (int fd : { listen_fd, signal_fd, epoll_fd })
+                if (fd >= 0)
+                    close(fd);
+        }
+
+        auto setup(const char *socket_path) -> bool;
+
+        auto loop() -> void;
+
+    private:
+        auto intern(std::string_view name) -> std::string_view;
+
+        // frees the touched names, which the event system does not need any
+        // more; only called once no event refers to them
+        auto release_names() -> void;
+
+        auto watch(int fd, std::uint32_t events, int op) -> bool;
+
+        auto accept_all() -> void;
+
+        auto drain(int fd, Connection &conn) -> bool;
+
+        auto flush(int fd, Connection &conn) -> bool;
+
+        auto drop(int fd) -> void;
+
+        auto take_lines(Connection &conn, bool closed) -> void;
+
+        auto fire_timers(timeutil::TimePoint time) -> void;
+
+        auto handle_batch() -> void;
+
+        auto broadcast() -> void;
+
+        auto shutdown() -> void;
+    };
+
+    auto Daemon::setup(const char *socket_path) -> bool
+    {
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+
+        if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "ERROR: socket path is too long: %s\n",
+                socket_path);
+            return false;
+        }
+        strcpy(addr.sun_path, socket_path);
+
+        listen_fd
+            = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            perror("ERROR: socket");
+            return false;
+        }
+
+        // a stale socket might be left behind by a previous run
+        unlink(socket_path);
+
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+            < 0) {
+            fprintf(stderr, "ERROR: cannot bind to %s: %s\n", socket_path,
+                strerror(errno));
+            return false;
+        }
+
+        if (listen(listen_fd, SOMAXCONN) < 0) {
+            perror("ERROR: listen");
+            return false;
+        }
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+        signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd < 0) {
+            perror("ERROR: signalfd");
+            return false;
+        }
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            perror("ERROR: epoll_create1");
+            return false;
+        }
+
+        return watch(listen_fd, EPOLLIN, EPOLL_CTL_ADD)
+            && watch(signal_fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    auto Daemon::loop() -> void
+    {
+        epoll_event events[max_epoll_events];
+
+        for (;;) {
+            const int n = epoll_wait(epoll_fd, events, max_epoll_events, -1);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                perror("ERROR: epoll_wait");
+                break;
+            }
+
+            bool stop = false;
+
+            for (int i = 0; i < n; ++i) {
+                const int fd = events[i].data.fd;
+
+                if (fd == listen_fd) {
+                    accept_all();
+                    continue;
+                }
+
+                if (fd == signal_fd) {
+                    stop = true;
+                    continue;
+                }
+
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+
+                bool alive = true;
+
+                if (events[i].events & EPOLLOUT)
+                    alive = flush(fd, it->second);
+
+                if (alive
+                    && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    alive = drain(fd, it->second);
+
+                if (!alive)
+                    drop(fd);
+            }
+
+            handle_batch();
+            broadcast();
+
+            if (stop)
+                break;
+        }
+
+        shutdown();
+    }
+
+    auto Daemon::intern(std::string_view name) -> std::string_view
+    {
+        auto it = names.find(name);
+        if (it == names.end())
+            it = names.emplace(name).first;
+
+        return *it;
+    }
+
+    auto Daemon::release_names() -> void
+    {
+        // a name might be touched several times, but is erased once, as the
+        // view is not valid afterwards
+        std::sort(touched.begin(), touched.end(), [](auto a, auto b) {
+            return std::less<> {}(a.data(), b.data());
+        });
+        touched.erase(std::unique(touched.begin(), touched.end(),
+                          [](auto a, auto b) { return a.data() == b.data(); }),
+            touched.end());
+
+        for (const auto name : touched)
+            if (!system.refers_to(name))
+                names.erase(names.find(name));
+
+        touched.clear();
+    }
+
+    auto Daemon::watch(int fd, std::uint32_t events, int op) -> bool
+    {
+        epoll_event ev {};
+        ev.events  = events;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+            perror("ERROR: epoll_ctl");
+            return false;
+        }
+
+        return true;
+    }
+
+    auto Daemon::accept_all() -> void
+    {
+        for (;;) {
+            const int fd = accept4(
+                listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    perror("ERROR: accept4");
+                return;
+            }
+
+            if (!watch(fd, EPOLLIN, EPOLL_CTL_ADD)) {
+                close(fd);
+                continue;
+            }
+
+            connections.emplace(fd, Connection {});
+        }
+    }
+
+    // reads what is available on the connection, up to
+    // `max_reads_per_wake_up` chunks; returns false if the peer is gone or
+    // has to be dropped
+    auto Daemon::drain(int fd, Connection &conn) -> bool
+    {
+        bool closed = false;
+
+        for (std::size_t reads = 0; reads < max_reads_per_wake_up;) {
+            const auto size = conn.in.size();
+            conn.in.resize(size + read_chunk_size);
+
+            const ssize_t n = read(fd, conn.in.data() + size, read_chunk_size);
+            conn.in.resize(size + (n > 0 ? n : 0));
+
+            if (n > 0) {
+                ++reads;
+                continue;
+            }
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+
+        take_lines(conn, closed);
+
+        if (conn.in.size() > max_line_size) {
+            fprintf(stderr, "ERROR: dropping a connection, line is too long\n");
+            return false;
+        }
+
+        return !closed;
+    }
+
+    // moves complete lines of the connection into the batch, handling
+    // connection-level commands on the way
+    auto Daemon::take_lines(Connection &conn, bool closed) -> void
+    {
+        // the last line is not required to end with '\n' once the peer is gone
+        if (closed && !conn.in.empty() && conn.in.back() != '\n')
+            conn.in.push_back('\n');
+
+        std::string_view rest { conn.in };
+        std::size_t      consumed = 0;
+
+        for (std::size_t eol;
+             (eol = rest.find('\n')) != std::string_view::npos;) {
+            const auto line = rest.substr(0, eol);
+
+            if (line == subscribe_command)
+                conn.subscribed = true;
+            else if (!line.empty())
+                batch.append(rest.data(), eol + 1);
+
+            rest.remove_prefix(eol + 1);
+            consumed += eol + 1;
+        }
+
+        conn.in.erase(0, consumed);
+    }
+
+    auto Daemon::flush(int fd, Connection &conn) -> bool
+    {
+        while (!conn.out.empty()) {
+            const ssize_t n
+                = send(fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+
+                break;
+            }
+
+            conn.out.erase(0, n);
+        }
+
+        if (conn.out.size() > max_pending_bytes)
+            return false;
+
+        // only ask for EPOLLOUT while there is something left to send
+        const bool wants_write = !conn.out.empty();
+        if (wants_write != conn.wants_write) {
+            conn.wants_write = wants_write;
+
+            std::uint32_t events = EPOLLIN;
+            if (wants_write)
+                events |= EPOLLOUT;
+
+            return watch(fd, events, EPOLL_CTL_MOD);
+        }
+
+        return true;
+    }
+
+    auto Daemon::drop(int fd) -> void
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    }
+
+    auto Daemon::fire_timers(timeutil::TimePoint time) -> void
+    {
+        fired.clear();
+        system.fire_timers(time, fired);
+
+        for (const auto &e : fired) {
+            event_system::format_event(outgoing, e);
+            touched.push_back(e.client_name);
+        }
+    }
+
+    auto Daemon::handle_batch() -> void
+    {
+        if (batch.empty())
+            return;
+
+        BasicParser parser(std::move(batch));
+        batch.clear();
+
+        for (event_system::Event e {}; !parser.eof();) {
+            if (!e.from_parser(parser) || !parser.skip('\n')) {
+                fprintf(stderr, "ERROR: skipping malformed event line\n");
+                parser.skip_line();
+                continue;
+            }
+
+            if (e.time < last_time) {
+                fprintf(stderr, "ERROR: skipping event earlier than the last "
+                                "handled one\n");
+                continue;
+            }
+            last_time = e.time;
+
+            e.client_name = intern(e.client_name);
+
+            fire_timers(e.time);
+            event_system::format_event(outgoing, e);
+
+            std::optional<event_system::Event> out_e;
+            system.handle_event(e, out_e);
+
+            if (out_e.has_value())
+                event_system::format_event(outgoing, out_e.value());
+
+            // the generated event is about a client, who is still inside, or
+            // about the same one; the timers might have ended the session of
+            // the event's client, so its name is released only now
+            touched.push_back(e.client_name);
+            release_names();
+        }
+    }
+
+    auto Daemon::broadcast() -> void
+    {
+        if (outgoing.empty())
+            return;
+
+        for (auto it = connections.begin(); it != connections.end();) {
+            auto &[fd, conn] = *it;
+
+            if (!conn.subscribed) {
+                ++it;
+                continue;
+            }
+
+            conn.out.append(outgoing);
+
+            if (flush(fd, conn)) {
+                ++it;
+                continue;
+            }
+
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            it = connections.erase(it);
+        }
+
+        outgoing.clear();
+    }
+
+    auto Daemon::shutdown() -> void
+    {
+        fire_timers(closing_time);
+
+        std::set<event_system::Event> last_events;
+        system.kick_everyone_out(last_events);
+
+        for (const auto &e : last_events)
+            event_system::format_event(outgoing, e);
+
+        // NOTE: whatever subscribers could not accept right away is lost
+        broadcast();
+
+        system.write_tables_stats(stdout, used_tables_only);
+
+        sockaddr_un addr {};
+        socklen_t   len = sizeof(addr);
+        if (getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len)
+            == 0)
+            unlink(addr.sun_path);
+    }
+
+} // namespace
+
+auto run(const char *socket_path, const event_system::Config &cfg,
+    const club::Options &options) -> bool
+{
+    Daemon daemon { cfg, options };
+
+    if (!daemon.setup(socket_path))
+        return false;
+
+    daemon.loop();
+
+    return true;
+}
+
+#else
+
+auto run(const char *socket_path, const event_system::Config &cfg,
+    const club::Options &options) -> bool
+{
+    fprintf(stderr, "ERROR: daemon mode is only supported on Linux\n");
+
+    return false;
+}
+
+#endif
+
+} // namespace server
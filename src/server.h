@@ -0,0 +1,27 @@
+#pragma once
+
+#include "club.h"
+#include "event_system.h"
+
+namespace server {
+
+// Runs the club as a long-lived process: listens on a Unix domain socket at
+// `socket_path`, accepts event lines (in the same format as the input file)
+// from any number of local producers and feeds them into a single resident
+// `EventSystem`.
+//
+// Every readable connection is drained on each epoll wake up and all complete
+// lines gathered during it are parsed and handled as one batch. Connections
+// which send a line `subscribe` receive the resulting event stream, in the
+// same format the program prints it in.
+//
+// Of the `options`, the time limits and `used_tables_only` apply. Timers fire
+// as the events' time goes past them, before the event which does so.
+//
+// On SIGINT or SIGTERM the club is closed: everyone is kicked out, the last
+// events are sent to subscribers and tables' statistics are printed to
+// `stdout`. Returns false if the socket could not be set up.
+auto run(const char *socket_path, const event_system::Config &cfg,
+    const club::Options &options) -> bool;
+
+} // namespace server
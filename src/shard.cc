@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "club.h"
+#include "memstats.h"
+#include "parser.h"
+#include "shard.h"
+#include "spsc_queue.h"
+
+namespace shard {
+
+namespace {
+
+    constexpr std::size_t queue_capacity = 4096;
+    constexpr std::size_t config_lines   = 3;
+
+    struct Line {
+        std::size_t      club;
+        std::string_view text; // without the club id prefix
+        bool             last { false }; // no lines follow, `text` is empty
+    };
+
+    // `std::hash` of an integer is the integer itself with libstdc++, so club
+    // ids sharing a stride with the shards' count would all land on the same
+    // shard; splitmix64's finalizer spreads them
+    auto mix(std::uint64_t x) -> std::uint64_t
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111eb;
+        x ^= x >> 31;
+
+        return x;
+    }
+
+    struct Club {
+        FILE       *out { nullptr };
+        bool        failed { false }; // the output could not be opened
+        // a malformed event ends the club's events, the same as in a file
+        bool        stopped { false };
+        std::string config;
+        std::size_t config_lines { 0 };
+
+        std::optional<club::Session> session;
+    };
+
+    class Shard {
+        SpscQueue<Line, queue_capacity> queue;
+
+        std::unordered_map<std::size_t, Club> clubs;
+
+        const char         *out_dir;
+        const club::Options &options;
+        bool                 ok { true };
+
+        std::thread thread;
+
+    public:
+        Shard(const char *out_dir, const club::Options &options)
+            : out_dir(out_dir)
+            , options(options)
+        {
+            thread = std::thread([this] { work(); });
+        }
+
+        auto push(const Line &line) -> void { queue.push(line); }
+
+        // waits for the lines pushed so far and closes every club
+        auto finish() -> bool
+        {
+            queue.push(Line { .club = 0, .text = {}, .last = true });
+            thread.join();
+
+            return ok;
+        }
+
+    private:
+        auto work() -> void
+        {
+            memstats::Scope scope { memstats::phase_simulate };
+
+            for (Line line;;) {
+                queue.pop(line);
+                if (line.last)
+                    break;
+
+                handle(line);
+            }
+
+            for (auto &[id, club] : clubs)
+                close(id, club);
+        }
+
+        auto open(std::size_t id, Club &club) -> void
+        {
+            const auto path
+                = std::string { out_dir } + '/' + std::to_string(id) + ".txt";
+
+            club.out = fopen(path.c_str(), "w");
+            if (club.out == nullptr) {
+                fprintf(stderr, "ERROR: cannot open file %s\n", path.c_str());
+                club.failed = true;
+                ok          = false;
+            }
+        }
+
+        auto configure(std::size_t id, Club &club) -> void
+        {
+            BasicParser parser(std::move(club.config));
+
+            event_system::Config cfg {};
+            if (!cfg.from_parser(parser)) {
+                fprintf(stderr, "ERROR: malformed config of club %zu\n", id);
+                club.stopped = true;
+                ok           = false;
+                return;
+            }
+
+            club.session.emplace(cfg, club.out, options);
+        }
+
+        auto handle(const Line &line) -> void
+        {
+            Club &club = clubs[line.club];
+
+            if (club.out == nullptr && !club.failed)
+                open(line.club, club);
+
+            if (club.failed || club.stopped)
+                return;
+
+            if (club.config_lines < config_lines) {
+                club.config.append(line.text);
+                club.config.push_back('\n');
+
+                if (++club.config_lines == config_lines)
+                    configure(line.club, club);
+                return;
+            }
+
+            // client names are left pointing into the stream
+            BasicParser         parser(line.text);
+            event_system::Event e {};
+            if (!e.from_parser(parser)) {
+                club.stopped = true;
+                return;
+            }
+
+            club.session->handle(e);
+
+            if (!parser.eof())
+                club.stopped = true;
+        }
+
+        auto close(std::size_t id, Club &club) -> void
+        {
+            if (club.out == nullptr)
+                return;
+
+            if (club.session.has_value())
+                club.session->close();
+            else if (club.config_lines < config_lines)
+                fprintf(stderr, "ERROR: incomplete config of club %zu\n", id);
+
+            if (fclose(club.out) != 0)
+                ok = false;
+        }
+    };
+
+} // namespace
+
+auto run(std::string_view source, const char *out_dir,
+    const club::Options &options) -> bool
+{
+    memstats::Scope scope { memstats::phase_simulate };
+
+    const auto n = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    for (unsigned i = 0; i < n; ++i)
+        shards.push_back(std::make_unique<Shard>(out_dir, options));
+
+    bool ok = true;
+
+    // splitting the stream into the clubs' lines, the rest of the parsing is
+    // done by the shards
+    {
+        memstats::Scope parse_scope { memstats::phase_parse };
+
+        std::size_t line_no = 0;
+        while (!source.empty()) {
+            const auto eol  = source.find('\n');
+            const auto line = source.substr(0, eol);
+            source.remove_prefix(eol == std::string_view::npos ? source.size()
+                                                               : eol + 1);
+            ++line_no;
+
+            // FORMAT: [CLUB ID] [SPACE] [LINE]
+            std::size_t club = 0;
+
+            const auto [ptr, ec]
+                = std::from_chars(line.data(), line.data() + line.size(), club);
+            if (ec != std::errc {} || ptr == line.data() + line.size()
+                || *ptr != ' ') {
+                fprintf(stderr, "ERROR: no club id on line %zu\n", line_no);
+                ok = false;
+                continue;
+            }
+
+            const auto text = line.substr(ptr - line.data() + 1);
+
+            shards[mix(club) % shards.size()]->push(
+                Line { .club = club, .text = text });
+        }
+    }
+
+    for (auto &shard : shards)
+        ok &= shard->finish();
+
+    return ok;
+}
+
+} // namespace shard
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string_view>
+
+#include "club.h"
+
+// Runs many clubs out of one combined stream, where every line is prefixed by
+// the club's id:
+//
+// FORMAT: [CLUB ID] [SPACE] [LINE]
+//
+// Lines of each club, once the prefix is stripped, make up the usual input:
+// the first three are the club's config and the rest are its events.
+//
+// Clubs are hash-partitioned onto a thread per core; each thread owns the
+// `EventSystem`s of its clubs and receives their lines over a lock-free queue.
+// Every club's output goes to its own file `[OUT DIR]/[CLUB ID].txt` and is
+// the same, as if the club's lines were run as a separate file.
+namespace shard {
+
+// `source` has to stay alive until it returns, client names are not copied.
+// Returns false if some lines or outputs had to be dropped.
+auto run(std::string_view source, const char *out_dir,
+    const club::Options &options) -> bool;
+
+} // namespace shard
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Besides the non-blocking `try_` calls, a side may block until the other one
+// makes room or pushes something: it spins shortly and then sleeps on the
+// index the other side moves (`std::atomic::wait`), so an idle thread does not
+// take a core.
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0,
+        "capacity has to be a power of two");
+
+    std::array<T, Capacity> slots {};
+
+    // kept on separate cache lines, as each one is written by its own thread
+    alignas(64) std::atomic<std::size_t> head { 0 }; // next slot to pop
+    alignas(64) std::atomic<std::size_t> tail { 0 }; // next slot to push
+
+    static constexpr int spin_count = 64;
+
+public:
+    // false if the queue is full
+    auto try_push(const T &value) -> bool
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        slots[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+
+        return true;
+    }
+
+    // false if the queue is empty
+    auto try_pop(T &value) -> bool
+    {
+        const auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        value = slots[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+
+        return true;
+    }
+
+    // blocks while the queue is full
+    auto push(const T &value) -> void
+    {
+        for (int spins = 0; !try_push(value); ++spins) {
+            if (spins < spin_count)
+                continue;
+
+            // sleeps for as long as the consumer stays at the same slot
+            const auto t = tail.load(std::memory_order_relaxed);
+            head.wait(t - Capacity, std::memory_order_acquire);
+        }
+    }
+
+    // blocks while the queue is empty
+    auto pop(T &value) -> void
+    {
+        for (int spins = 0; !try_pop(value); ++spins) {
+            if (spins < spin_count)
+                continue;
+
+            // sleeps for as long as nothing is pushed
+            const auto h = head.load(std::memory_order_relaxed);
+            tail.wait(h, std::memory_order_acquire);
+        }
+    }
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "timeutil.h"
+
+// Hierarchical timing wheel over `timeutil::TimePoint` ticks (minutes).
+//
+// Level 0 has a slot per tick, every next level has a slot per whole previous
+// level, so a timer is placed by the highest bit it differs in from the
+// current time. Timers move down a level each time the wheel reaches the
+// start of their slot, and fire from level 0. Scheduling and cancelling are
+// O(1), advancing is O(1) per tick and per timer move, and empty stretches of
+// time are skipped altogether when no timer is pending.
+template <typename T>
+class TimingWheel {
+public:
+    using Handle = std::size_t;
+
+    static constexpr Handle no_timer = std::numeric_limits<Handle>::max();
+
+private:
+    static constexpr std::size_t slot_bits  = 6;
+    static constexpr std::size_t slot_count = 1 << slot_bits;
+    static constexpr std::size_t level_count
+        = (std::numeric_limits<timeutil::TimePoint>::digits + slot_bits - 1)
+        / slot_bits;
+
+    // marks the nodes, which are detached from their slot to be fired
+    static constexpr std::size_t firing = level_count * slot_count;
+    // marks the nodes, which are free to be reused
+    static constexpr std::size_t unused = firing + 1;
+
+    struct Node {
+        timeutil::TimePoint due;
+        std::uint64_t       seq; // timers due at the same tick fire in order
+        T                   value;
+        std::size_t         slot;
+        Handle              prev;
+        Handle              next;
+    };
+
+    std::vector<Node>   nodes;
+    std::vector<Handle> free_nodes;
+
+    std::array<Handle, level_count * slot_count> heads;
+    std::array<Handle, level_count * slot_count> tails;
+
+    timeutil::TimePoint now { 0 };
+    std::size_t         pending { 0 };
+    std::uint64_t       next_seq { 0 };
+
+    std::vector<Handle> batch; // reused by `advance`
+
+    [[nodiscard]] auto slot_for(timeutil::TimePoint due) const -> std::size_t
+    {
+        const auto diff  = std::max(due, now) ^ now;
+        const auto level = diff == 0
+            ? 0
+            : (static_cast<std::size_t>(std::bit_width(diff)) - 1) / slot_bits;
+
+        return level * slot_count
+            + ((std::max(due, now) >> (level * slot_bits)) & (slot_count - 1));
+    }
+
+    auto link(Handle h) -> void
+    {
+        Node &n = nodes[h];
+        n.slot  = slot_for(n.due);
+        n.prev  = tails[n.slot];
+        n.next  = no_timer;
+
+        if (n.prev == no_timer)
+            heads[n.slot] = h;
+        else
+            nodes[n.prev].next = h;
+        tails[n.slot] = h;
+    }
+
+    auto unlink(Handle h) -> void
+    {
+        Node &n = nodes[h];
+
+        if (n.prev == no_timer)
+            heads[n.slot] = n.next;
+        else
+            nodes[n.prev].next = n.next;
+
+        if (n.next == no_timer)
+            tails[n.slot] = n.prev;
+        else
+            nodes[n.next].prev = n.prev;
+    }
+
+    auto release(Handle h) -> void
+    {
+        nodes[h].slot  = unused;
+        nodes[h].value = T {};
+        free_nodes.push_back(h);
+    }
+
+    // moves the timers of the level's current slot to the lower levels
+    auto cascade(std::size_t level) -> void
+    {
+        const auto index = (now >> (level * slot_bits)) & (slot_count - 1);
+        const auto slot  = level * slot_count + index;
+
+        Handle h = heads[slot];
+        heads[slot] = tails[slot] = no_timer;
+
+        while (h != no_timer) {
+            const Handle next = nodes[h].next;
+            link(h);
+            h = next;
+        }
+    }
+
+    // whether the current time starts a slot of the level
+    [[nodiscard]] auto aligned(std::size_t level) const -> bool
+    {
+        const auto span = timeutil::TimePoint { 1 } << (level * slot_bits);
+        return (now & (span - 1)) == 0;
+    }
+
+    auto step() -> void
+    {
+        ++now;
+
+        // higher levels go first, as their timers might land on a lower
+        // level's slot, which is due to be cascaded right now as well
+        std::size_t top = 0;
+        while (top + 1 < level_count && aligned(top + 1))
+            ++top;
+
+        for (std::size_t level = top; level > 0; --level)
+            cascade(level);
+    }
+
+public:
+    TimingWheel()
+    {
+        heads.fill(no_timer);
+        tails.fill(no_timer);
+    }
+
+    // a timer due in the past fires on the next `advance`
+    auto schedule(timeutil::TimePoint due, T value) -> Handle
+    {
+        Handle h;
+        if (free_nodes.empty()) {
+            h = nodes.size();
+            nodes.push_back({});
+        } else {
+            h = free_nodes.back();
+            free_nodes.pop_back();
+        }
+
+        nodes[h].due   = due;
+        nodes[h].seq   = next_seq++;
+        nodes[h].value = std::move(value);
+        link(h);
+
+        ++pending;
+
+        return h;
+    }
+
+    // no-op for `no_timer`; the handle must not be used afterwards
+    auto cancel(Handle h) -> void
+    {
+        if (h == no_timer || nodes[h].slot == unused)
+            return;
+
+        // the timer is in the batch being fired, it is skipped there
+        if (nodes[h].slot != firing)
+            unlink(h);
+
+        release(h);
+        --pending;
+    }
+
+    // fires every timer due at or before `until`, in the order of their due
+    // time and then of scheduling; `fire` may schedule and cancel timers
+    template <typename F>
+    auto advance(timeutil::TimePoint until, F &&fire) -> void
+    {
+        for (;;) {
+            const auto slot = now & (slot_count - 1);
+
+            while (heads[slot] != no_timer) {
+                batch.clear();
+                for (Handle h = heads[slot]; h != no_timer; h = nodes[h].next) {
+                    nodes[h].slot = firing;
+                    batch.push_back(h);
+                }
+                heads[slot] = tails[slot] = no_timer;
+
+                // cascaded timers and directly scheduled ones might interleave
+                std::sort(batch.begin(), batch.end(),
+                    [this](Handle a, Handle b) {
+                        return nodes[a].seq < nodes[b].seq;
+                    });
+
+                for (const Handle h : batch) {
+                    if (nodes[h].slot != firing)
+                        continue; // cancelled by one of the previous timers
+
+                    const auto due   = nodes[h].due;
+                    T          value = std::move(nodes[h].value);
+                    release(h);
+                    --pending;
+
+                    fire(due, value);
+                }
+            }
+
+            if (now >= until)
+                return;
+
+            if (pending == 0) {
+                now = until;
+                return;
+            }
+
+            step();
+        }
+    }
+
+    // drops every timer
+    auto clear() -> void
+    {
+        nodes.clear();
+        free_nodes.clear();
+        heads.fill(no_timer);
+        tails.fill(no_timer);
+        pending = 0;
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return pending; }
+};